@@ -0,0 +1,97 @@
+#ifndef BATCH_SCHEDULER_HPP
+#define BATCH_SCHEDULER_HPP
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <exception>
+#include "Estimator.hpp"
+
+/**
+ * @brief 跨请求的批处理调度器：多个线程同时调用separate，各请求的段被收集到同一次推理中
+ *
+ * 各请求在调用线程上完成前端与掩码、逆变换，只有推理由调度线程按批执行。
+ * 调度器存在期间，Estimator不能再被直接使用。
+ */
+class BatchScheduler {
+public:
+    /**
+     * @brief 按max_batch所在的batch_buckets档位建好会话并推理一次，然后启动调度线程
+     *
+     * 每批不论收集到多少段都补零到该档位，始终复用同一个会话
+     *
+     * @param estimator 执行推理的Estimator
+     * @param max_batch 每次推理的最大段数
+     * @param max_wait_ms 最早的请求到达后，等待凑满一批的最长时间
+     * @throw std::runtime_error 参数无效
+     */
+    BatchScheduler(Estimator& estimator, int max_batch, int max_wait_ms);
+    ~BatchScheduler();
+    BatchScheduler(const BatchScheduler&) = delete;
+    BatchScheduler& operator=(const BatchScheduler&) = delete;
+
+    /**
+     * @brief 分离一段音频，可在多个线程上同时调用，输出与Estimator::separate一致
+     *
+     * @param in 输入音频数据
+     * @param byte_size 输入字节数
+     * @param outputs 各声部的输出缓冲区，与Estimator::stems()顺序一致
+     * @return 每路输出的字节数
+     * @throw 推理中的异常在调用线程上重新抛出
+     */
+    size_t separate(const char *in, size_t byte_size, const std::vector<char*>& outputs);
+    /**
+     * @brief 已执行的推理次数
+     *
+     */
+    size_t batches() const;
+    /**
+     * @brief 已推理的段数
+     *
+     */
+    size_t segments() const;
+private:
+    /**
+     * @brief 等待推理的请求，其段可能被拆到多次推理中
+     *
+     */
+    struct Request {
+        const float* magnitudes;                         ///< 模型输入
+        int num_segments;                                ///< 段数
+        int next_segment;                                ///< 下一个尚未送入推理的段
+        int pending_segments;                            ///< 尚未完成推理的段数
+        std::vector<std::vector<float>>* masks;          ///< 各模型的输出
+        std::chrono::steady_clock::time_point arrival;   ///< 到达时间
+        std::exception_ptr error;                        ///< 推理失败时的异常，在调用线程上重新抛出
+    };
+
+    /**
+     * @brief 一次推理中属于某个请求的连续若干段
+     *
+     */
+    struct Slice {
+        Request* request;
+        int first;
+        int count;
+    };
+
+    void run();
+
+    Estimator& estimator;
+    int max_batch;
+    std::chrono::milliseconds max_wait;
+    mutable std::mutex mutex;
+    std::condition_variable wake;       ///< 有新请求或需要退出
+    std::condition_variable finished;   ///< 有请求完成推理
+    std::deque<Request*> queue;
+    int queued_segments;
+    bool stopping;
+    size_t num_batches;
+    size_t num_segments;
+    std::thread worker;
+};
+
+#endif // BATCH_SCHEDULER_HPP
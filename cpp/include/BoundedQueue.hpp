@@ -0,0 +1,42 @@
+#ifndef BOUNDED_QUEUE_HPP
+#define BOUNDED_QUEUE_HPP
+
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+
+// FIFO between two threads holding at most `capacity` items: push() blocks
+// while the queue is full and pop() while it is empty.
+template <typename T>
+class BoundedQueue {
+public:
+    explicit BoundedQueue(size_t capacity) : capacity(capacity > 0 ? capacity : 1) {}
+
+    BoundedQueue(const BoundedQueue&) = delete;
+    BoundedQueue& operator=(const BoundedQueue&) = delete;
+
+    void push(T item) {
+        std::unique_lock<std::mutex> lock(this->mutex);
+        this->not_full.wait(lock, [this]() { return this->items.size() < this->capacity; });
+        this->items.push_back(std::move(item));
+        this->not_empty.notify_one();
+    }
+
+    T pop() {
+        std::unique_lock<std::mutex> lock(this->mutex);
+        this->not_empty.wait(lock, [this]() { return !this->items.empty(); });
+        T item = std::move(this->items.front());
+        this->items.pop_front();
+        this->not_full.notify_one();
+        return item;
+    }
+
+private:
+    size_t capacity;
+    std::deque<T> items;
+    std::mutex mutex;
+    std::condition_variable not_full;
+    std::condition_variable not_empty;
+};
+
+#endif // BOUNDED_QUEUE_HPP
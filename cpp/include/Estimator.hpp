@@ -2,7 +2,11 @@
 #define ESTIMATOR_HPP
 
 #include <vector>
+#include <map>
+#include <memory>
+#include <functional>
 #include <string>
+#include <atomic>
 #include <cmath>
 #include <complex>
 #include "Eigen/Dense"
@@ -10,6 +14,10 @@
 #include "MNN/MNNDefine.h"
 #include "MNN/Interpreter.hpp"
 #include "MNN/Tensor.hpp"
+#include "Stft.hpp"
+#include "ModelBundle.hpp"
+#include "ThreadPool.hpp"
+#include "BoundedQueue.hpp"
 
 /**
  * @brief 音频数据格式
@@ -30,24 +38,260 @@ typedef struct SignalInfoT {
     enum AudioDataFormat data_format; ///< 音频数据格式
 } SignalInfo;
 
+/**
+ * @brief 推理后端与调度选项
+ *
+ */
+struct EstimatorOptions {
+    std::vector<MNNForwardType> forward_types;  ///< 按顺序尝试的推理后端，实际未启用的后端会被跳过，为空时依次尝试OpenCL和CPU
+    int num_threads = 1;                        ///< CPU后端的推理线程数
+    int gpu_mode = MNN_GPU_TUNING_NONE;         ///< GPU后端的模式参数，见MNNGpuMode
+    MNN::BackendConfig::PrecisionMode precision = MNN::BackendConfig::Precision_High; ///< 计算精度
+    MNN::BackendConfig::MemoryMode memory = MNN::BackendConfig::Memory_Normal;        ///< 内存模式
+    MNN::BackendConfig::PowerMode power = MNN::BackendConfig::Power_Normal;           ///< 功耗模式
+    bool concurrent_sessions = false;           ///< 各声部的推理与逆变换是否由线程池并行执行
+    int stem_workers = 0;                       ///< concurrent_sessions时线程池的线程数（含调用线程），0表示与声部数相同
+    std::vector<int> session_threads;           ///< 各声部会话的CPU线程数，未指定的会话使用num_threads
+    int chunk_segments = 1;                     ///< 分块分离时每块包含的T帧段数，决定峰值内存
+    int pipeline_depth = 0;                     ///< 大于0时分块分离按前端、推理、掩码与逆变换三级流水执行，为各级之间队列的容量
+    int stream_frames = 512;                    ///< 流式分离时每次推理的帧数，须为64的倍数，决定延迟
+    float silence_threshold_db = 0.0f;          ///< 段内最响一帧在模型输入频带内的能量低于该dBFS值时跳过推理，各声部平分该段，0表示不检测
+    bool right_size_tail = false;               ///< 最后一个不满的段按不小于其帧数的最小64的倍数推理，而不是补零到整段；各长度需要各自的会话
+    int max_batch = 0;                          ///< 整段分离每次推理的最大段数，段数更多时分批送入按此大小建好的同一个会话，0表示不限
+    std::vector<int> batch_buckets;             ///< 升序的批大小档位，B向上补零到最近的档位以复用会话，为空时按实际B缓存
+    int session_cache_size = 4;                 ///< 每个模型最多缓存的不同输入形状的会话数
+    bool packed_layout = false;                 ///< 前端与掩码按NC4HW4打包布局读写会话张量，要求模型的输入输出张量本身为NC4HW4，否则构造时抛出异常
+    bool shared_runtime = false;                ///< 所有会话由同一个RuntimeInfo创建，共享内存池，不能与concurrent_sessions同时使用
+    std::vector<std::string> cache_files;       ///< 各模型的后端调优缓存文件，为空时不使用，失效或损坏时自动重建
+    bool mmap_models = false;                   ///< 以只读内存映射读取模型文件并通过createFromBuffer加载
+    std::vector<std::string> output_stems;      ///< 只输出这些声部，为空时输出全部；其余声部的模型照常推理，但跳过掩码、逆变换与输出转换
+    std::string derived_mask_stem;              ///< 不加载也不推理该声部的模型，其掩码近似为1减其余声部掩码之和，2声部时推理量减半
+    bool complementary_stem = false;            ///< 输出全部声部时，最后一个声部取混合信号的重建减去其余声部，省去它的掩码与逆变换；与精确结果相差输入在F以上频带的成分
+};
+
 class Estimator {
+    friend class BatchScheduler;
 public:
-    Estimator(const std::string& vocal_model_path, const std::string& accompaniment_model_path, const SignalInfo in_signal);
+    Estimator(const std::string& vocal_model_path, const std::string& accompaniment_model_path, const SignalInfo in_signal, const EstimatorOptions& options = EstimatorOptions());
+    /**
+     * @brief 从模型包创建，模型、张量名与STFT参数均取自模型包
+     *
+     * @param bundle_path 模型包路径，格式见ModelBundle
+     * @param in_signal 输入音频参数
+     * @param options 推理选项
+     */
+    Estimator(const std::string& bundle_path, const SignalInfo in_signal, const EstimatorOptions& options = EstimatorOptions());
+    /**
+     * @brief 从已打开的模型包或自行组装的模型列表创建
+     *
+     */
+    Estimator(const ModelBundle& bundle, const SignalInfo in_signal, const EstimatorOptions& options = EstimatorOptions());
     ~Estimator();
-    std::pair<Eigen::Tensor<float, 4, Eigen::RowMajor>, Eigen::Tensor<float, 3, Eigen::RowMajor>> compute_stft(const Eigen::Tensor<float, 2, Eigen::RowMajor>& wav);
-    Eigen::Tensor<float, 2, Eigen::RowMajor> compute_istft(const Eigen::Tensor<float, 4, Eigen::RowMajor>& stft);
+    Eigen::Tensor<std::complex<float>, 3, Eigen::RowMajor> compute_stft(const Eigen::Tensor<float, 2, Eigen::RowMajor>& wav, float* mag);
+    /**
+     * @brief 以全部声部的掩码归一化，并只为需要的声部生成掩码后的频谱
+     *
+     * @param masks 各声部模型的输出，至多一个为空，其掩码取1减其余掩码之和
+     * @param wanted 各声部是否需要，为空时全部需要，不需要的声部返回空张量
+     */
+    std::vector<Eigen::Tensor<std::complex<float>, 3, Eigen::RowMajor>> apply_masks(const Eigen::Tensor<std::complex<float>, 3, Eigen::RowMajor>& stft, const std::vector<const float*>& masks, int segment_frames, const std::vector<bool>& wanted = std::vector<bool>());
+    Eigen::Tensor<float, 2, Eigen::RowMajor> compute_istft(const Eigen::Tensor<std::complex<float>, 3, Eigen::RowMajor>& stft);
     size_t addFrames(char *in, size_t size);
+    /**
+     * @brief 分离addFrames送入的音频，仅用于2个声部的模型
+     *
+     */
     size_t separate(char *out_1, char *out_2);
+    /**
+     * @brief 分离addFrames送入的音频，适用于任意声部数
+     *
+     * @param outputs 各声部的输出缓冲区，与stems()顺序一致，为空指针或不在output_stems中的声部不输出
+     * @return 每路输出的字节数
+     */
+    size_t separate(const std::vector<char*>& outputs);
+    /**
+     * @brief 分块分离，直接读取交错排列的输入并写出结果，不经过addFrames
+     *
+     * 每次处理chunk_segments * T帧，峰值内存只与块大小有关，与音频长度无关，
+     * 输出与addFrames + separate逐位一致
+     *
+     * @param in 输入音频数据
+     * @param byte_size 输入字节数
+     * @param out_1 人声输出
+     * @param out_2 伴奏输出
+     * @return 每路输出的字节数
+     */
+    size_t separate(const char *in, size_t byte_size, char *out_1, char *out_2);
+    /**
+     * @brief 分块分离，适用于任意声部数
+     *
+     * @param in 输入音频数据
+     * @param byte_size 输入字节数
+     * @param outputs 各声部的输出缓冲区，与stems()顺序一致，为空指针或不在output_stems中的声部不输出
+     * @return 每路输出的字节数
+     */
+    size_t separate(const char *in, size_t byte_size, const std::vector<char*>& outputs);
+    /**
+     * @brief 流式分离：送入任意长度的音频数据，累积满stream_frames帧后即完成一块推理
+     *
+     * @param in 输入音频数据
+     * @param byte_size 输入字节数
+     * @return 接收的字节数
+     */
+    size_t push(const char *in, size_t byte_size);
+    /**
+     * @brief 流式分离：取出已完成的分离结果，输出与输入逐样本对齐
+     *
+     * @param out_1 人声输出
+     * @param out_2 伴奏输出
+     * @param byte_size 每路输出缓冲区的字节数
+     * @return 每路写出的字节数
+     */
+    size_t pull(char *out_1, char *out_2, size_t byte_size);
+    /**
+     * @brief 流式分离：取出已完成的分离结果，适用于任意声部数
+     *
+     * @param outputs 各声部的输出缓冲区，与stems()顺序一致，只写入output_stems中的声部，空指针表示丢弃该声部的结果
+     * @param byte_size 每路输出缓冲区的字节数
+     * @return 每路写出的字节数
+     */
+    size_t pull(const std::vector<char*>& outputs, size_t byte_size);
+    /**
+     * @brief 流式分离：输入结束，处理剩余数据，之后的push开始新的流
+     *
+     */
+    void flush();
+    /**
+     * @brief 流式分离：丢弃所有流式状态与未取出的结果
+     *
+     */
+    void reset_stream();
+    /**
+     * @brief 流式分离：每路可取出的字节数
+     *
+     */
+    size_t available() const;
+    /**
+     * @brief 流式分离：一个输入样本送入后，到其分离结果可取出的最大延迟，单位为样本数
+     *
+     */
+    size_t latency() const;
+    /**
+     * @brief 各声部名称，与输出顺序一致
+     *
+     */
+    const std::vector<std::string>& stems() const;
+    /**
+     * @brief 启用silence_threshold_db后经过静音检测的段数
+     *
+     */
+    size_t gated_segments() const;
+    /**
+     * @brief 其中因静音跳过推理的段数
+     *
+     */
+    size_t skipped_segments() const;
+    /**
+     * @brief 预先为给定的批大小（不超过max_batch，按batch_buckets取档）和流式分离的形状建好会话并各推理一次
+     *
+     * @param batch_sizes 常用的批大小B
+     */
+    void warm_up(const std::vector<int>& batch_sizes);
 private:
+    /**
+     * @brief 流式分离的跨调用状态
+     *
+     */
+    struct StreamState {
+        std::vector<std::vector<float>> input;   ///< 各声道尚未处理的输入，从下一帧的起点开始，含前端N/2个补零
+        std::vector<std::vector<float>> overlap; ///< 各声部尚未完成的重叠相加结果
+        std::vector<std::vector<float>> output;  ///< 各声部交错排列、待取出的结果
+        int64_t num_samples = 0;                 ///< 已送入的样本数
+        int64_t num_frames = 0;                  ///< 已处理的帧数
+        int64_t emitted = 0;                     ///< 已完成的输出样本数，含前端N/2个补零
+    };
+
+    /**
+     * @brief 流水线中的一块，依次经过前端、推理、掩码与逆变换三级
+     *
+     */
+    struct PipelineChunk {
+        int64_t first;                                                 ///< 第一帧的序号
+        int num_frames;                                                ///< 帧数
+        std::vector<float> input;                                      ///< 各声道的输入窗口
+        Eigen::Tensor<std::complex<float>, 3, Eigen::RowMajor> stft;  ///< 前端的频谱
+        std::vector<float> magnitudes;                                 ///< 模型输入
+        std::vector<std::vector<float>> masks;                         ///< 各模型输出，未推理的模型为空
+    };
+
+    /**
+     * @brief 已按某一输入形状调整好的会话
+     *
+     */
+    struct CachedSession {
+        MNN::Session* session; ///< 会话
+        uint64_t last_use;     ///< 最近一次使用的序号，用于淘汰
+    };
+
+    void process_stream_chunk(int num_frames, bool last);
+    void check_outputs(const std::vector<char*>& outputs) const;
+    std::vector<bool> wanted_stems(const std::vector<char*>& outputs) const;
+    void for_each_stem(const std::function<void(size_t)>& task);
+    void overlap_add(StftEngine& engine, const Eigen::Tensor<std::complex<float>, 3, Eigen::RowMajor>& stft, float* wav, Eigen::Index stride);
+    bool complement_last(const std::vector<bool>& wanted) const;
+    void add_mixture(const float* signal, Eigen::Index signal_stride, Eigen::Index num_samples, Eigen::Index offset, int num_frames, float* wav, Eigen::Index stride) const;
+    void subtract_stems(const std::vector<float*>& outputs, Eigen::Index stride, Eigen::Index length) const;
+    int session_threads(size_t index) const;
+    int batch_bucket(int B) const;
+    MNN::Session* prepare_session(size_t index, int B, int segment_frames);
+
+    void load_model(const ModelSource& source);
+    MNN::Session* create_session(MNN::Interpreter* interpreter, int num_threads);
+    Eigen::Index model_offset(Eigen::Index segment, int c, int t, int segment_frames) const;
+    int model_stride() const;
+    Eigen::Index model_segment_size(int segment_frames) const;
+    void write_magnitudes(float* frame, const std::complex<float>* spectrum, int c) const;
+    void run_models(int B, int segment_frames, const std::function<void(float*)>& write_input, const std::function<void(const std::vector<const float*>&)>& read_outputs, int min_batch = 0);
+    int tail_frames(int num_frames, int segment_frames) const;
+    void copy_segment(const float* src, int src_frames, float* dst, int dst_frames, int num_frames) const;
+    bool silent_segment(const float* segment, int segment_frames) const;
+    void fill_silent(std::vector<std::vector<float>>& masks, Eigen::Index size, Eigen::Index offset, Eigen::Index count) const;
+    void infer_segments(int B, int segment_frames, int tail, const float* magnitudes, std::vector<std::vector<float>>& masks);
+    void separate_chunk(const float* input, Eigen::Index input_stride, int num_frames, int segment_frames, const std::vector<float*>& outputs, Eigen::Index output_stride);
+    void chunk_front_end(const float* input, Eigen::Index input_stride, int num_frames, int segment_frames, Eigen::Tensor<std::complex<float>, 3, Eigen::RowMajor>& stft, float* mag, StftEngine& engine) const;
+    void chunk_back_end(const float* input, Eigen::Index input_stride, const Eigen::Tensor<std::complex<float>, 3, Eigen::RowMajor>& stft, const std::vector<const float*>& masks, int segment_frames, const std::vector<float*>& outputs, Eigen::Index output_stride, StftEngine* engine);
+    size_t separate_request(const char* in, size_t byte_size, const std::vector<char*>& outputs, const std::function<void(int, const float*, std::vector<std::vector<float>>&)>& infer);
+    void run_pipeline(int64_t num_frames, int chunk_frames, Eigen::Index window_length, const std::function<void(int64_t, int, float*)>& read_window, const std::vector<float*>& outputs, const std::function<void(int64_t, int)>& finish_chunk);
+
     int F;
     int T;
     int win_length;
     int hop_length;
     Eigen::VectorXf win;
+    Eigen::VectorXf win_squared;  ///< 分析窗与合成窗之积，用于重建混合信号
+    StftEngine stft_engine;
+    std::string input_name;
+    std::string output_name;
+    std::vector<std::string> stem_names;
+    std::vector<bool> stem_outputs;  ///< 各声部是否在output_stems中
+    size_t first_output;             ///< 第一个输出的声部
+    size_t derived_stem;             ///< derived_mask_stem的序号，未使用时等于声部数
+    float silence_energy;            ///< silence_threshold_db换算成的一帧模型输入能量
+    std::atomic<size_t> num_gated;   ///< 经过静音检测的段数，BatchScheduler会在多个线程上更新
+    std::atomic<size_t> num_skipped; ///< 因静音跳过推理的段数
     SignalInfo signal_info;
+    EstimatorOptions options;
+    MNN::BackendConfig backend_config;
     Eigen::Tensor<float, 2, Eigen::RowMajor> wav;
     std::vector<MNN::Interpreter *> interpreters;
-    std::vector<MNN::Session *> sessions;
+    std::vector<MNN::Session *> sessions;  ///< 尚未绑定输入形状的会话
+    std::vector<std::map<std::pair<int, int>, CachedSession>> session_cache; ///< 各模型按(B, 段帧数)缓存的会话
+    std::vector<uint64_t> session_uses;
+    std::vector<bool> cache_pending;     ///< 各模型是否有新调整形状的会话待写入调优缓存
+    std::map<std::pair<int, int>, MNN::RuntimeInfo> runtimes; ///< shared_runtime时按(后端, 线程数或GPU模式)共享的运行时
+    std::unique_ptr<ThreadPool> stem_pool;  ///< concurrent_sessions时调度各声部任务的线程池
+    std::vector<StftEngine> stem_engines;   ///< 各声部逆变换独占的STFT引擎，可并行使用
+    StreamState stream;
 };
 
 #endif // ESTIMATOR_HPP
@@ -0,0 +1,62 @@
+#ifndef MODEL_BUNDLE_HPP
+#define MODEL_BUNDLE_HPP
+
+#include <vector>
+#include <string>
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * @brief 单个声部模型的来源，data非空时从内存加载，否则从path加载
+ *
+ */
+struct ModelSource {
+    std::string name;           ///< 声部名称
+    std::string path;           ///< 模型文件路径
+    const void* data = nullptr; ///< 模型数据，指向模型包的映射
+    size_t size = 0;            ///< 模型数据字节数
+};
+
+/**
+ * @brief 模型包：全部声部模型及分离流程的配置
+ *
+ * 文件格式（小端序）：
+ * - 160字节文件头：magic "SMNB"，版本号，声部数，F，T，win_length，hop_length，
+ *   64字节输入张量名，64字节输出张量名，数据区的CRC-32
+ * - 每个声部48字节：32字节声部名，模型数据的偏移与字节数（uint64）
+ * - 模型数据，按64字节对齐
+ *
+ * 可用python/pack_bundle.py打包
+ */
+class ModelBundle {
+public:
+    /**
+     * @brief 默认配置，与2stems模型一致，不含任何声部
+     *
+     */
+    ModelBundle();
+    /**
+     * @brief 以一次只读内存映射打开模型包，并一次性校验文件头、声部表与数据区
+     *
+     * @param bundle_path 模型包路径
+     * @throw std::runtime_error 文件无法打开或校验失败
+     */
+    explicit ModelBundle(const std::string& bundle_path);
+    ModelBundle(ModelBundle&& other);
+    ModelBundle(const ModelBundle&) = delete;
+    ModelBundle& operator=(const ModelBundle&) = delete;
+    ~ModelBundle();
+
+    int F;                            ///< 送入模型的频点数
+    int T;                            ///< 每段的帧数
+    int win_length;                   ///< STFT窗长
+    int hop_length;                   ///< STFT帧移
+    std::string input_name;           ///< 模型输入张量名
+    std::string output_name;          ///< 模型输出张量名
+    std::vector<ModelSource> stems;   ///< 各声部模型
+private:
+    void* mapping;
+    size_t mapping_size;
+};
+
+#endif // MODEL_BUNDLE_HPP
@@ -1,14 +1,16 @@
-
 #ifndef STFT_HPP
 #define STFT_HPP
 
 #include <Eigen/Dense>
 #include <unsupported/Eigen/FFT>
 #include <vector>
+#include <complex>
 #include <cmath>
+#include <cassert>
+#include <algorithm>
 
 // Function to apply Hanning window
-Eigen::VectorXf hanningWindow(int win_length) {
+inline Eigen::VectorXf hanningWindow(int win_length) {
     Eigen::VectorXf window(win_length);
     for (int i = 0; i < win_length; ++i) {
         window(i) = 0.5 * (1 - cos(2 * M_PI * i / (win_length - 1)));
@@ -16,7 +18,7 @@ Eigen::VectorXf hanningWindow(int win_length) {
     return window;
 }
 
-Eigen::VectorXf periodicHanningWindow(int win_length) {
+inline Eigen::VectorXf periodicHanningWindow(int win_length) {
     Eigen::VectorXf window(win_length);
     for (int i = 0; i < win_length; ++i) {
         window(i) = 0.5 * (1 - cos(2 * M_PI * i / win_length));
@@ -25,7 +27,7 @@ Eigen::VectorXf periodicHanningWindow(int win_length) {
 }
 
 // Function to perform STFT
-Eigen::MatrixXcf stft(const Eigen::VectorXf& signal, int n_fft, int hop_length, int win_length, const Eigen::VectorXf& win) {
+inline Eigen::MatrixXcf stft(const Eigen::VectorXf& signal, int n_fft, int hop_length, int win_length, const Eigen::VectorXf& win) {
     Eigen::FFT<float> fft;
     int half_n_fft = n_fft / 2;
 
@@ -47,4 +49,224 @@ Eigen::MatrixXcf stft(const Eigen::VectorXf& signal, int n_fft, int hop_length,
     return stft_matrix;
 }
 
-#endif // STFT_HPP
\ No newline at end of file
+// Windowed real FFT engine for a fixed frame size.
+//
+// The real transform of n_fft points is computed as an n_fft / 2 point complex
+// FFT over the even/odd samples plus a split step, the same scheme kissfft_impl
+// uses. The complex kernel is an iterative radix-2 FFT written with plain float
+// arithmetic, std::complex multiplication goes through the NaN-checking
+// __mulsc3 path unless -ffast-math is on. Twiddles, the bit reversal table,
+// the window and all scratch buffers are built once in the constructor, so
+// forward() and inverse() never allocate.
+class StftEngine {
+public:
+    typedef std::complex<float> Complex;
+
+    StftEngine(int n_fft, int hop_length, const Eigen::VectorXf& win)
+        : n_fft(n_fft), hop_length(hop_length), win(win),
+          bit_reverse(n_fft / 2), twiddles(n_fft / 2), real_twiddles(n_fft / 4),
+          frame_buf(n_fft), spectrum_buf(n_fft / 2) {
+        int ncfft = n_fft / 2;
+        assert(ncfft >= 2 && (ncfft & (ncfft - 1)) == 0 && win.size() == n_fft);
+
+        int bits = 0;
+        while ((1 << bits) < ncfft) {
+            ++bits;
+        }
+        for (int i = 0; i < ncfft; ++i) {
+            int r = 0;
+            for (int b = 0; b < bits; ++b) {
+                r |= ((i >> b) & 1) << (bits - 1 - b);
+            }
+            this->bit_reverse[i] = r;
+        }
+
+        // Stage with half length m uses twiddles[m - 1 .. 2m - 2] = exp(-i*pi*j/m).
+        for (int m = 1; m < ncfft; m <<= 1) {
+            for (int j = 0; j < m; ++j) {
+                double phase = -M_PI * j / m;
+                this->twiddles[m - 1 + j] = Complex(static_cast<float>(std::cos(phase)), static_cast<float>(std::sin(phase)));
+            }
+        }
+        for (int k = 1; k <= ncfft / 2; ++k) {
+            double phase = -M_PI * (static_cast<double>(k) / ncfft + 0.5);
+            this->real_twiddles[k - 1] = Complex(static_cast<float>(std::cos(phase)), static_cast<float>(std::sin(phase)));
+        }
+    }
+
+    int fft_size() const { return this->n_fft; }
+    int hop_size() const { return this->hop_length; }
+    int num_bins() const { return this->n_fft / 2 + 1; }
+    const Eigen::VectorXf& window() const { return this->win; }
+
+    // Number of frames stft() produces for a signal of num_samples samples.
+    int num_frames(int num_samples) const { return 1 + num_samples / this->hop_length; }
+
+    // Windowed real-to-complex transform of one frame of n_fft samples,
+    // writes the n_fft / 2 + 1 non-negative frequency bins.
+    void forward(const float* frame, Complex* spectrum) {
+        forward(frame, spectrum, this->num_bins());
+    }
+
+    // Truncated forward transform, writes only bins [0, num_bins).
+    void forward(const float* frame, Complex* spectrum, int num_bins) {
+        for (int i = 0; i < this->n_fft; ++i) {
+            this->frame_buf[i] = frame[i] * this->win(i);
+        }
+        transform_frame(spectrum, num_bins);
+    }
+
+    // Complex-to-real transform of n_fft / 2 + 1 bins, scaled by 1 / n_fft and
+    // multiplied by the synthesis window, writes n_fft samples.
+    void inverse(const Complex* spectrum, float* frame) {
+        inverse(spectrum, this->num_bins(), frame);
+    }
+
+    // Inverse transform of a spectrum whose bins at or above num_bins are zero,
+    // only bins [0, num_bins) are read.
+    void inverse(const Complex* spectrum, int num_bins, float* frame) {
+        synthesize(spectrum, num_bins);
+        float scale = 1.0f / this->n_fft;
+        for (int i = 0; i < this->n_fft; ++i) {
+            frame[i] = this->frame_buf[i] * scale * this->win(i);
+        }
+    }
+
+    // Same as inverse() but adds the windowed frame onto out, for overlap-add.
+    void inverse_add(const Complex* spectrum, int num_bins, float* out) {
+        synthesize(spectrum, num_bins);
+        float scale = 1.0f / this->n_fft;
+        for (int i = 0; i < this->n_fft; ++i) {
+            out[i] += this->frame_buf[i] * scale * this->win(i);
+        }
+    }
+
+    // Same framing as stft(): the signal is centered with n_fft / 2 zeros on
+    // both sides, the padding is applied per frame instead of on a copy.
+    Eigen::MatrixXcf stft(const Eigen::VectorXf& signal) {
+        return stft(signal, this->num_bins());
+    }
+
+    // STFT keeping only bins [0, num_bins), the result has num_bins rows.
+    Eigen::MatrixXcf stft(const Eigen::VectorXf& signal, int num_bins) {
+        assert(num_bins > 0 && num_bins <= this->num_bins());
+        int num_samples = signal.size();
+        int num_frames = this->num_frames(num_samples);
+        Eigen::MatrixXcf stft_matrix(num_bins, num_frames);
+
+        for (int i = 0; i < num_frames; ++i) {
+            stft_frame(signal.data(), num_samples, i, stft_matrix.col(i).data(), num_bins);
+        }
+
+        return stft_matrix;
+    }
+
+    // Frame index of the centered STFT of signal, bins [0, num_bins).
+    void stft_frame(const float* signal, int num_samples, int index, Complex* spectrum, int num_bins) {
+        int start = index * this->hop_length - this->n_fft / 2;
+        for (int j = 0; j < this->n_fft; ++j) {
+            int idx = start + j;
+            this->frame_buf[j] = (idx >= 0 && idx < num_samples) ? signal[idx] * this->win(j) : 0.0f;
+        }
+        transform_frame(spectrum, num_bins);
+    }
+
+private:
+    static Complex multiply(const Complex& a, const Complex& b) {
+        return Complex(a.real() * b.real() - a.imag() * b.imag(), a.real() * b.imag() + a.imag() * b.real());
+    }
+
+    // Out-of-place radix-2 decimation-in-time FFT of n_fft / 2 points,
+    // unscaled in both directions.
+    void complex_fft(Complex* out, const Complex* in, bool inverse) {
+        int ncfft = this->n_fft / 2;
+        for (int i = 0; i < ncfft; ++i) {
+            out[i] = in[this->bit_reverse[i]];
+        }
+
+        float* data = reinterpret_cast<float*>(out);
+        float sign = inverse ? -1.0f : 1.0f;
+        for (int m = 1; m < ncfft; m <<= 1) {
+            const float* tw = reinterpret_cast<const float*>(this->twiddles.data() + m - 1);
+            for (int base = 0; base < ncfft; base += 2 * m) {
+                float* a = data + 2 * base;
+                float* b = a + 2 * m;
+                for (int j = 0; j < m; ++j) {
+                    float wr = tw[2 * j];
+                    float wi = sign * tw[2 * j + 1];
+                    float tr = b[2 * j] * wr - b[2 * j + 1] * wi;
+                    float ti = b[2 * j] * wi + b[2 * j + 1] * wr;
+                    b[2 * j] = a[2 * j] - tr;
+                    b[2 * j + 1] = a[2 * j + 1] - ti;
+                    a[2 * j] += tr;
+                    a[2 * j + 1] += ti;
+                }
+            }
+        }
+    }
+
+    // Unscaled complex-to-real transform into frame_buf. The half spectrum is
+    // packed into an n_fft / 2 point complex FFT, bins k and n_fft / 2 - k
+    // share one slot, the zero bins at or above num_bins are never loaded and
+    // slots where both are zero are cleared directly.
+    void synthesize(const Complex* spectrum, int num_bins) {
+        assert(num_bins > 0 && num_bins <= this->num_bins());
+        int ncfft = this->n_fft / 2;
+        Complex* buf = this->spectrum_buf.data();
+        float nyquist = num_bins > ncfft ? spectrum[ncfft].real() : 0.0f;
+        buf[0] = Complex(spectrum[0].real() + nyquist, spectrum[0].real() - nyquist);
+        for (int k = 1; k <= ncfft / 2; ++k) {
+            bool has_k = k < num_bins;
+            bool has_nk = ncfft - k < num_bins;
+            if (!has_k && !has_nk) {
+                buf[k] = buf[ncfft - k] = Complex(0.0f, 0.0f);
+                continue;
+            }
+            Complex fk = has_k ? spectrum[k] : Complex(0.0f, 0.0f);
+            Complex fnkc = has_nk ? std::conj(spectrum[ncfft - k]) : Complex(0.0f, 0.0f);
+            Complex fek = fk + fnkc;
+            Complex fok = multiply(fk - fnkc, std::conj(this->real_twiddles[k - 1]));
+            buf[k] = fek + fok;
+            buf[ncfft - k] = std::conj(fek - fok);
+        }
+        complex_fft(reinterpret_cast<Complex*>(this->frame_buf.data()), buf, true);
+    }
+
+    // Real FFT of frame_buf: an n_fft / 2 point complex FFT over the even/odd
+    // samples, then the split into the half spectrum. Bin k of the split reads
+    // the half-length spectrum at k and n_fft / 2 - k, so all of it is needed
+    // for any num_bins above n_fft / 4; the truncation only skips the split of
+    // the bins at or above num_bins.
+    void transform_frame(Complex* spectrum, int num_bins) {
+        int ncfft = this->n_fft / 2;
+        Complex* buf = this->spectrum_buf.data();
+        complex_fft(buf, reinterpret_cast<const Complex*>(this->frame_buf.data()), false);
+
+        spectrum[0] = Complex(buf[0].real() + buf[0].imag());
+        if (num_bins > ncfft) {
+            spectrum[ncfft] = Complex(buf[0].real() - buf[0].imag());
+        }
+        int split_end = std::min(ncfft / 2, num_bins - 1);
+        for (int k = 1; k <= split_end; ++k) {
+            Complex fpk = buf[k];
+            Complex fpnk = std::conj(buf[ncfft - k]);
+            Complex f1k = fpk + fpnk;
+            Complex tw = multiply(fpk - fpnk, this->real_twiddles[k - 1]);
+            spectrum[k] = (f1k + tw) * 0.5f;
+            if (ncfft - k < num_bins) {
+                spectrum[ncfft - k] = std::conj(f1k - tw) * 0.5f;
+            }
+        }
+    }
+
+    int n_fft;
+    int hop_length;
+    Eigen::VectorXf win;
+    std::vector<int> bit_reverse;
+    std::vector<Complex> twiddles;
+    std::vector<Complex> real_twiddles;
+    std::vector<float> frame_buf;
+    std::vector<Complex> spectrum_buf;
+};
+
+#endif // STFT_HPP
@@ -0,0 +1,125 @@
+#ifndef THREAD_POOL_HPP
+#define THREAD_POOL_HPP
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <exception>
+
+// Fixed set of worker threads running one indexed batch of tasks at a time.
+//
+// run(count, task) calls task(0) .. task(count - 1) on the workers and the
+// calling thread and returns once all of them finished. The first exception
+// a task throws is rethrown from run() after the whole batch finished.
+// Batches are not reentrant: a task must not call run() on the same pool.
+class ThreadPool {
+public:
+    explicit ThreadPool(int num_threads) : task(nullptr), count(0), next(0), pending(0), generation(0), stopping(false) {
+        // The calling thread takes part in every batch
+        for (int i = 1; i < num_threads; ++i) {
+            this->workers.emplace_back(&ThreadPool::work, this);
+        }
+    }
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            this->stopping = true;
+        }
+        this->wake.notify_all();
+        for (auto& worker : this->workers) {
+            worker.join();
+        }
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    int size() const { return static_cast<int>(this->workers.size()) + 1; }
+
+    void run(size_t count, const std::function<void(size_t)>& task) {
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            this->task = &task;
+            this->count = count;
+            this->next = 0;
+            this->pending = count;
+            this->error = nullptr;
+            ++this->generation;
+        }
+        this->wake.notify_all();
+
+        drain();
+        std::unique_lock<std::mutex> lock(this->mutex);
+        this->done.wait(lock, [this]() { return this->pending == 0; });
+        this->task = nullptr;
+        if (this->error) {
+            std::exception_ptr error = this->error;
+            this->error = nullptr;
+            std::rethrow_exception(error);
+        }
+    }
+
+private:
+    // Takes tasks of the current batch until none are left
+    void drain() {
+        for (;;) {
+            size_t index;
+            const std::function<void(size_t)>* current;
+            {
+                std::lock_guard<std::mutex> lock(this->mutex);
+                if (!this->task || this->next >= this->count) {
+                    return;
+                }
+                index = this->next++;
+                current = this->task;
+            }
+
+            std::exception_ptr error;
+            try {
+                (*current)(index);
+            } catch (...) {
+                error = std::current_exception();
+            }
+
+            std::lock_guard<std::mutex> lock(this->mutex);
+            if (error && !this->error) {
+                this->error = error;
+            }
+            if (--this->pending == 0) {
+                this->done.notify_all();
+            }
+        }
+    }
+
+    void work() {
+        size_t seen = 0;
+        for (;;) {
+            {
+                std::unique_lock<std::mutex> lock(this->mutex);
+                this->wake.wait(lock, [this, seen]() { return this->stopping || this->generation != seen; });
+                if (this->stopping) {
+                    return;
+                }
+                seen = this->generation;
+            }
+            drain();
+        }
+    }
+
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+    const std::function<void(size_t)>* task;
+    size_t count;
+    size_t next;
+    size_t pending;
+    size_t generation;
+    std::exception_ptr error;  // first exception of the current batch
+    bool stopping;
+};
+
+#endif // THREAD_POOL_HPP
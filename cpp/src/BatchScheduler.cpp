@@ -0,0 +1,141 @@
+#include <stdexcept>
+#include <algorithm>
+#include "BatchScheduler.hpp"
+
+BatchScheduler::BatchScheduler(Estimator& estimator, int max_batch, int max_wait_ms) : estimator(estimator), max_batch(max_batch),
+    max_wait(max_wait_ms), queued_segments(0), stopping(false), num_batches(0), num_segments(0) {
+    if (max_batch < 1) {
+        throw std::runtime_error("Maximum batch size must be positive.");
+    }
+    if (max_wait_ms < 0) {
+        throw std::runtime_error("Maximum wait must not be negative.");
+    }
+
+    // Every batch is padded to the bucket of max_batch, so one session sized
+    // up front serves them all whatever number of segments was collected.
+    int bucket = estimator.batch_bucket(max_batch);
+    Eigen::Index input_size = bucket * estimator.model_segment_size(estimator.T);
+    estimator.run_models(bucket, estimator.T, [input_size](float* input) {
+        std::fill(input, input + input_size, 0.0f);
+    }, [](const std::vector<const float*>&) {});
+    this->worker = std::thread(&BatchScheduler::run, this);
+}
+
+BatchScheduler::~BatchScheduler() {
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->stopping = true;
+    }
+    this->wake.notify_all();
+    this->worker.join();
+}
+
+size_t BatchScheduler::separate(const char *in, size_t byte_size, const std::vector<char*>& outputs) {
+    return this->estimator.separate_request(in, byte_size, outputs, [this](int B, const float* magnitudes, std::vector<std::vector<float>>& masks) {
+        Request request = {magnitudes, B, 0, B, &masks, std::chrono::steady_clock::now(), nullptr};
+        std::unique_lock<std::mutex> lock(this->mutex);
+        this->queue.push_back(&request);
+        this->queued_segments += B;
+        this->wake.notify_all();
+        this->finished.wait(lock, [&request]() { return request.pending_segments == 0; });
+        if (request.error) {
+            std::rethrow_exception(request.error);
+        }
+    });
+}
+
+size_t BatchScheduler::batches() const {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    return this->num_batches;
+}
+
+size_t BatchScheduler::segments() const {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    return this->num_segments;
+}
+
+void BatchScheduler::run() {
+    Eigen::Index segment_size = this->estimator.model_segment_size(this->estimator.T);
+    int bucket = this->estimator.batch_bucket(this->max_batch);
+    for (;;) {
+        // Wait for the first request, then until the batch is full or the
+        // oldest request has waited max_wait. Requests are served in order,
+        // one larger than the batch is split over several runs.
+        std::vector<Slice> slices;
+        int B = 0;
+        {
+            std::unique_lock<std::mutex> lock(this->mutex);
+            this->wake.wait(lock, [this]() { return this->stopping || !this->queue.empty(); });
+            if (this->queue.empty()) {
+                return;
+            }
+            this->wake.wait_until(lock, this->queue.front()->arrival + this->max_wait, [this]() {
+                return this->stopping || this->queued_segments >= this->max_batch;
+            });
+            while (!this->queue.empty() && B < this->max_batch) {
+                Request* request = this->queue.front();
+                int count = std::min(this->max_batch - B, request->num_segments - request->next_segment);
+                Slice slice = {request, request->next_segment, count};
+                slices.push_back(slice);
+                request->next_segment += count;
+                B += count;
+                if (request->next_segment == request->num_segments) {
+                    this->queue.pop_front();
+                }
+            }
+            this->queued_segments -= B;
+        }
+
+        // The slices are packed one after the other into the batch and their
+        // masks copied back to the owning requests. A failure is handed to
+        // every request in the batch and rethrown on its own thread.
+        std::exception_ptr error;
+        try {
+            this->estimator.run_models(B, this->estimator.T, [&](float* mag) {
+                for (const Slice& slice : slices) {
+                    const float* magnitudes = slice.request->magnitudes + slice.first * segment_size;
+                    mag = std::copy(magnitudes, magnitudes + slice.count * segment_size, mag);
+                }
+            }, [&](const std::vector<const float*>& outputs) {
+                Eigen::Index offset = 0;
+                for (const Slice& slice : slices) {
+                    std::vector<std::vector<float>>& masks = *slice.request->masks;
+                    for (size_t i = 0; i < outputs.size(); ++i) {
+                        if (!outputs[i]) {
+                            continue;
+                        }
+                        masks[i].resize(slice.request->num_segments * segment_size);
+                        std::copy(outputs[i] + offset, outputs[i] + offset + slice.count * segment_size, masks[i].begin() + slice.first * segment_size);
+                    }
+                    offset += slice.count * segment_size;
+                }
+            }, bucket);
+        } catch (...) {
+            error = std::current_exception();
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            for (const Slice& slice : slices) {
+                Request* request = slice.request;
+                if (!error) {
+                    request->pending_segments -= slice.count;
+                    continue;
+                }
+                // The rest of a failed request is dropped from the queue
+                if (request->next_segment < request->num_segments) {
+                    this->queued_segments -= request->num_segments - request->next_segment;
+                    request->next_segment = request->num_segments;
+                    this->queue.erase(std::find(this->queue.begin(), this->queue.end(), request));
+                }
+                request->error = error;
+                request->pending_segments = 0;
+            }
+            if (!error) {
+                ++this->num_batches;
+                this->num_segments += B;
+            }
+        }
+        this->finished.notify_all();
+    }
+}
@@ -1,11 +1,19 @@
 #include <iostream>
 #include <stdexcept>
 #include <functional>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <exception>
+#include <algorithm>
+#include <cstdio>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 #include "Estimator.hpp"
-#include "Stft.hpp"
-
-#define INPUT_NAME "onnx::Pad_0"
-#define OUTPUT_NAME "379"
 
 template<typename T, int NDIMS, int Options = Eigen::ColMajor>
 static void print_helper(const Eigen::Tensor<T, NDIMS, Options>& tensor, const Eigen::Vector<long, NDIMS>& max_elements_per_dim) {
@@ -42,177 +50,746 @@ static void print_helper(const Eigen::Tensor<T, NDIMS, Options>& tensor, const E
     printValues(0, indices);
 }
 
-static Eigen::Tensor<float, 4, Eigen::RowMajor> pad_and_partition(const Eigen::Tensor<float, 4, Eigen::RowMajor>& array, int T) {
-    int num_batches = array.dimension(0);
-    int num_channels = array.dimension(1);
-    int num_freq_bins = array.dimension(2);
-    int L = array.dimension(3);
+// MNN quietly falls back to CPU when a backend is not available, so check
+// which backends the session really got.
+static bool session_uses_backend(MNN::Interpreter* interpreter, MNN::Session* session, MNNForwardType type) {
+    int backends[MNN_FORWARD_ALL + 1];
+    std::fill(backends, backends + MNN_FORWARD_ALL + 1, -1);
+    if (!interpreter->getSessionInfo(session, MNN::Interpreter::BACKENDS, backends)) {
+        return true;
+    }
+    return std::find(backends, backends + MNN_FORWARD_ALL + 1, static_cast<int>(type)) != backends + MNN_FORWARD_ALL + 1;
+}
+
+// Sample `index` of an interleaved PCM buffer, as addFrames converts it.
+static float read_sample(const char* in, AudioDataFormat format, size_t index) {
+    if (format == PCM_16BIT) {
+        return reinterpret_cast<const short*>(in)[index] / static_cast<float>(INT16_MAX);
+    }
+    return reinterpret_cast<const float*>(in)[index];
+}
+
+// Store sample `index` of an interleaved PCM buffer, as separate converts it.
+static void write_sample(char* out, AudioDataFormat format, size_t index, float value) {
+    if (format == PCM_16BIT) {
+        reinterpret_cast<short*>(out)[index] = static_cast<short>(value * INT16_MAX);
+    } else {
+        reinterpret_cast<float*>(out)[index] = value;
+    }
+}
+
+// Reads the model through a read-only mapping of the file instead of the
+// loader's private read buffer. createFromBuffer still copies the weights,
+// so every process keeps its own copy; only the staging buffer is saved, and
+// the mapping is dropped right away.
+static MNN::Interpreter* create_from_mapped_file(const std::string& model_path) {
+#ifdef _WIN32
+    return MNN::Interpreter::createFromFile(model_path.c_str());
+#else
+    int fd = open(model_path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return nullptr;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+        close(fd);
+        return nullptr;
+    }
+    size_t size = static_cast<size_t>(st.st_size);
+    void* data = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        return nullptr;
+    }
+    madvise(data, size, MADV_SEQUENTIAL);
+    MNN::Interpreter* interpreter = MNN::Interpreter::createFromBuffer(data, size);
+    munmap(data, size);
+    return interpreter;
+#endif
+}
 
-    int new_size = std::ceil(static_cast<float>(L) / T) * T;
-    int pad_size = new_size - L;
+// The two separate model files of the 2stems model, with the default
+// pipeline configuration.
+static ModelBundle two_stem_bundle(const std::string& vocal_model_path, const std::string& accompaniment_model_path) {
+    ModelBundle bundle;
+    ModelSource vocal;
+    vocal.name = "vocal";
+    vocal.path = vocal_model_path;
+    bundle.stems.push_back(vocal);
+    ModelSource accompaniment;
+    accompaniment.name = "accompaniment";
+    accompaniment.path = accompaniment_model_path;
+    bundle.stems.push_back(accompaniment);
+    return bundle;
+}
 
-    // Calculate the number of splits
-    int split = new_size / T;
+Estimator::Estimator(const std::string& vocal_model_path, const std::string& accompaniment_model_path, const SignalInfo in_signal, const EstimatorOptions& options)
+    : Estimator(two_stem_bundle(vocal_model_path, accompaniment_model_path), in_signal, options) {
+}
 
-    // Create result tensor with the correct shape
-    Eigen::Tensor<float, 4, Eigen::RowMajor> result(num_batches * split, num_channels, num_freq_bins, T);
+Estimator::Estimator(const std::string& bundle_path, const SignalInfo in_signal, const EstimatorOptions& options)
+    : Estimator(ModelBundle(bundle_path), in_signal, options) {
+}
 
-    // If no padding is needed, we can directly partition the original array
-    if (pad_size == 0) {
-        for (int i = 0; i < split; ++i) {
-            result.slice(Eigen::DSizes<Eigen::Index, 4>{i * num_batches, 0, 0, 0}, Eigen::DSizes<Eigen::Index, 4>{num_batches, num_channels, num_freq_bins, T}) = 
-                array.slice(Eigen::DSizes<Eigen::Index, 4>{0, 0, 0, i * T}, Eigen::DSizes<Eigen::Index, 4>{num_batches, num_channels, num_freq_bins, T});
+Estimator::Estimator(const ModelBundle& bundle, const SignalInfo in_signal, const EstimatorOptions& options) : F(bundle.F), T(bundle.T), win_length(bundle.win_length), hop_length(bundle.hop_length),
+    win(periodicHanningWindow(win_length)), win_squared(win.cwiseProduct(win)), stft_engine(win_length, hop_length, win), input_name(bundle.input_name), output_name(bundle.output_name),
+    num_gated(0), num_skipped(0) {
+    this->signal_info = in_signal;
+    this->options = options;
+    if (this->options.forward_types.empty()) {
+        this->options.forward_types.push_back(MNN_FORWARD_OPENCL);
+        this->options.forward_types.push_back(MNN_FORWARD_CPU);
+    }
+    if (options.num_threads < 1) {
+        throw std::runtime_error("Thread count must be positive.");
+    }
+    for (size_t i = 0; i < options.session_threads.size(); ++i) {
+        if (options.session_threads[i] < 1) {
+            throw std::runtime_error("Session thread count must be positive.");
         }
-    } else {
-        // Pad the last dimension with zeros
-        Eigen::array<std::pair<int, int>, 4> paddings = {std::make_pair(0, 0), std::make_pair(0, 0), std::make_pair(0, 0), std::make_pair(0, pad_size)};
-        Eigen::Tensor<float, 4, Eigen::RowMajor> padded_array = array.pad(paddings);
+    }
+    if (options.chunk_segments < 1) {
+        throw std::runtime_error("Chunk segment count must be positive.");
+    }
+    if (options.pipeline_depth < 0) {
+        throw std::runtime_error("Pipeline depth must not be negative.");
+    }
+    if (options.stream_frames < 64 || options.stream_frames % 64 != 0) {
+        throw std::runtime_error("Stream frame count must be a positive multiple of 64.");
+    }
+    for (size_t i = 0; i < options.batch_buckets.size(); ++i) {
+        if (options.batch_buckets[i] < 1 || (i > 0 && options.batch_buckets[i] <= options.batch_buckets[i - 1])) {
+            throw std::runtime_error("Batch buckets must be positive and ascending.");
+        }
+    }
+    if (options.stem_workers < 0) {
+        throw std::runtime_error("Stem worker count must not be negative.");
+    }
+    if (options.max_batch < 0) {
+        throw std::runtime_error("Maximum batch size must not be negative.");
+    }
+    if (options.silence_threshold_db > 0.0f) {
+        throw std::runtime_error("Silence threshold must not be above 0 dBFS.");
+    }
+    if (options.session_cache_size < 1) {
+        throw std::runtime_error("Session cache size must be positive.");
+    }
+    if (options.shared_runtime && options.concurrent_sessions) {
+        throw std::runtime_error("Sessions sharing a runtime cannot run concurrently.");
+    }
+    // By Parseval a frame of both channels holds win_length / 2 * |win|^2
+    // times the mean square of the signal across its one-sided spectrum.
+    this->silence_energy = std::pow(10.0f, options.silence_threshold_db / 10.0f) * this->win_length * this->win.squaredNorm();
+    this->backend_config.memory = options.memory;  // Memory
+    this->backend_config.power = options.power;  // Power
+    this->backend_config.precision = options.precision;  // Precision
+
+    if (bundle.stems.empty()) {
+        throw std::runtime_error("Model bundle holds no stems.");
+    }
+
+    // The model of a derived_mask_stem is never loaded, its mask comes from
+    // the other stems.
+    this->derived_stem = bundle.stems.size();
+    for (size_t i = 0; i < bundle.stems.size() && !options.derived_mask_stem.empty(); ++i) {
+        if (bundle.stems[i].name == options.derived_mask_stem) {
+            this->derived_stem = i;
+        }
+    }
+    if (!options.derived_mask_stem.empty() && (this->derived_stem == bundle.stems.size() || bundle.stems.size() < 2)) {
+        throw std::runtime_error("Derived mask stem must be one of at least 2 stems.");
+    }
+
+    // Load each stem model and create its session
+    for (const ModelSource& stem : bundle.stems) {
+        if (this->interpreters.size() == this->derived_stem) {
+            this->interpreters.push_back(nullptr);
+            this->sessions.push_back(nullptr);
+        } else {
+            load_model(stem);
+        }
+        this->stem_names.push_back(stem.name);
+        this->stem_engines.push_back(this->stft_engine);
+    }
 
-        // Partition the padded tensor into segments of length T
-        for (int i = 0; i < split; ++i) {
-            result.slice(Eigen::DSizes<Eigen::Index, 4>{i * num_batches, 0, 0, 0}, Eigen::DSizes<Eigen::Index, 4>{num_batches, num_channels, num_freq_bins, T}) = 
-                padded_array.slice(Eigen::DSizes<Eigen::Index, 4>{0, 0, 0, i * T}, Eigen::DSizes<Eigen::Index, 4>{num_batches, num_channels, num_freq_bins, T});
+    // Stems left out of output_stems still run their model for the mask
+    // normalization, everything after that is skipped.
+    for (const std::string& name : this->options.output_stems) {
+        if (std::find(this->stem_names.begin(), this->stem_names.end(), name) == this->stem_names.end()) {
+            throw std::runtime_error("Unknown output stem: " + name + ".");
         }
     }
+    for (const std::string& name : this->stem_names) {
+        const std::vector<std::string>& output_stems = this->options.output_stems;
+        this->stem_outputs.push_back(output_stems.empty() || std::find(output_stems.begin(), output_stems.end(), name) != output_stems.end());
+    }
+    this->first_output = std::find(this->stem_outputs.begin(), this->stem_outputs.end(), true) - this->stem_outputs.begin();
+
+    if (this->options.concurrent_sessions) {
+        int workers = this->options.stem_workers > 0 ? this->options.stem_workers : static_cast<int>(bundle.stems.size());
+        this->stem_pool.reset(new ThreadPool(workers));
+    }
 
-    return result;
+    this->session_cache.resize(this->interpreters.size());
+    this->session_uses.resize(this->interpreters.size(), 0);
+    this->cache_pending.resize(this->interpreters.size(), false);
+    reset_stream();
 }
 
-Estimator::Estimator(const std::string& vocal_model_path, const std::string& accompaniment_model_path, const SignalInfo in_signal) : F(1024), T(512), win_length(4096), hop_length(1024) {
-    this->win = periodicHanningWindow(this->win_length);
-    this->signal_info = in_signal;
+void Estimator::load_model(const ModelSource& source) {
+    const std::string& name = source.name;
+    size_t index = this->interpreters.size();
+    const std::string* cache_file = index < this->options.cache_files.size() && !this->options.cache_files[index].empty() ? &this->options.cache_files[index] : nullptr;
 
+    // A stale cache is reset by MNN itself. If the session still cannot be
+    // created, the file is deleted and the model loaded once more, so the
+    // cache is rebuilt from scratch.
+    int attempts = cache_file ? 2 : 1;
     MNN::Interpreter* interpreter = nullptr;
     MNN::Session* session = nullptr;
-
-    // Load vocal model and create session
-    interpreter = MNN::Interpreter::createFromFile(vocal_model_path.c_str());
-    if (!interpreter) {
-        throw std::runtime_error("Failed to load vocal model.");
+    for (int attempt = 0; attempt < attempts && !session; ++attempt) {
+        delete interpreter;
+        if (source.data) {
+            interpreter = MNN::Interpreter::createFromBuffer(source.data, source.size);
+        } else if (this->options.mmap_models) {
+            interpreter = create_from_mapped_file(source.path);
+        } else {
+            interpreter = MNN::Interpreter::createFromFile(source.path.c_str());
+        }
+        if (!interpreter) {
+            throw std::runtime_error("Failed to load " + name + " model.");
+        }
+        if (cache_file) {
+            if (attempt > 0) {
+                std::remove(cache_file->c_str());
+            }
+            interpreter->setCacheFile(cache_file->c_str());
+        }
+        session = create_session(interpreter, this->session_threads(index));
     }
     this->interpreters.push_back(interpreter);
-    MNN::ScheduleConfig config_vocal;
-    config_vocal.numThread = 1;
-    int forward = MNN_FORWARD_OPENCL;
-    config_vocal.type = static_cast<MNNForwardType>(forward);
-    MNN::BackendConfig backendConfig;
-    backendConfig.memory = MNN::BackendConfig::Memory_Normal;  // Memory
-    backendConfig.power = MNN::BackendConfig::Power_Normal;  // Power
-    backendConfig.precision = MNN::BackendConfig::PrecisionMode::Precision_High;  // Precision
-    config_vocal.backendConfig = &backendConfig;
-
-    session = interpreter->createSession(config_vocal);
     if (!session) {
-        throw std::runtime_error("Failed to create session for vocal model.");
+        throw std::runtime_error("Failed to create session for " + name + " model.");
     }
     this->sessions.push_back(session);
 
-    // Load accompaniment model and create session
-    interpreter = MNN::Interpreter::createFromFile(accompaniment_model_path.c_str());
-    if (!interpreter) {
-        throw std::runtime_error("Failed to load accompaniment model.");
-    }
-    this->interpreters.push_back(interpreter);
-    MNN::ScheduleConfig config_accompaniment;
-    config_accompaniment.numThread = 1;
-    config_accompaniment.type = static_cast<MNNForwardType>(forward);
-    config_accompaniment.backendConfig = &backendConfig;
-    session = interpreter->createSession(config_accompaniment);
-    if (!session) {
-        throw std::runtime_error("Failed to create session for accompaniment model.");
+    // The packed layout writes and reads the session tensors' own buffers,
+    // which only hold 4 lanes per bin when the tensors are NC4HW4.
+    if (this->options.packed_layout) {
+        MNN::Tensor* input = interpreter->getSessionInput(session, this->input_name.c_str());
+        MNN::Tensor* output = interpreter->getSessionOutput(session, this->output_name.c_str());
+        if (!input || !output || input->getDimensionType() != MNN::Tensor::CAFFE_C4 || output->getDimensionType() != MNN::Tensor::CAFFE_C4) {
+            throw std::runtime_error("Packed layout needs NC4HW4 input and output tensors in the " + name + " model.");
+        }
     }
-    this->sessions.push_back(session);
 }
 
 Estimator::~Estimator() {
-    for (size_t i = 0; i < this->sessions.size(); ++i) {
+    for (size_t i = 0; i < this->interpreters.size(); ++i) {
         if (this->interpreters[i]) {
-            this->interpreters[i]->releaseSession(this->sessions[i]);
+            if (this->sessions[i]) {
+                this->interpreters[i]->releaseSession(this->sessions[i]);
+            }
+            for (auto& cached : this->session_cache[i]) {
+                this->interpreters[i]->releaseSession(cached.second.session);
+            }
             this->interpreters[i]->releaseModel();
             delete this->interpreters[i];
             this->interpreters[i] = nullptr;
         }
     }
 
+    this->session_cache.clear();
     this->sessions.clear();
     this->interpreters.clear();
 }
 
-std::pair<Eigen::Tensor<float, 4, Eigen::RowMajor>, Eigen::Tensor<float, 3, Eigen::RowMajor>> Estimator::compute_stft(const Eigen::Tensor<float, 2, Eigen::RowMajor>& wav) {
+Eigen::Tensor<std::complex<float>, 3, Eigen::RowMajor> Estimator::compute_stft(const Eigen::Tensor<float, 2, Eigen::RowMajor>& wav, float* mag) {
     int num_channels = wav.dimension(0);
     int num_samples = wav.dimension(1);
-    int num_frames = 1 + (num_samples + this->win_length - this->win_length) / this->hop_length;
+    int num_frames = this->stft_engine.num_frames(num_samples);
+    int padded_frames = (num_frames + this->T - 1) / this->T * this->T;
 
-    Eigen::Tensor<float, 4, Eigen::RowMajor> stft_stereo(num_channels, this->F, num_frames, 2);
-    Eigen::Tensor<float, 3, Eigen::RowMajor> mag_stereo(num_channels, this->F, num_frames);
+    // stft is C x L x F, frame j of channel c lands in mag at segment j / T,
+    // row j % T of the {B, C, T, F} model input, in the model layout.
+    Eigen::Tensor<std::complex<float>, 3, Eigen::RowMajor> stft(num_channels, num_frames, this->F);
+    for (int c = 0; c < num_channels; ++c) {
+        const float* signal = wav.data() + static_cast<Eigen::Index>(c) * num_samples;
+        for (int j = 0; j < padded_frames; ++j) {
+            float* mag_frame = mag + model_offset(j / this->T, c, j % this->T, this->T);
+            if (j >= num_frames) {
+                write_magnitudes(mag_frame, nullptr, c);
+                continue;
+            }
 
-    for (int i = 0; i < num_channels; ++i) {
-        Eigen::Map<const Eigen::VectorXf> vec(wav.data() + i * num_samples, num_samples);
-        Eigen::MatrixXcf stft_mono = stft(vec, this->win_length, this->hop_length, this->win_length, this->win);
+            std::complex<float>* spectrum = stft.data() + (static_cast<Eigen::Index>(c) * num_frames + j) * this->F;
+            this->stft_engine.stft_frame(signal, num_samples, j, spectrum, this->F);
+            write_magnitudes(mag_frame, spectrum, c);
+        }
+    }
 
-        for (int j = 0; j < num_frames; ++j) {
-            for (int k = 0; k < this->F; ++k) {
-                const auto& complex_val = stft_mono(k, j);
-                stft_stereo(i, k, j, 0) = complex_val.real();
-                stft_stereo(i, k, j, 1) = complex_val.imag();
-                mag_stereo(i, k, j) = std::abs(complex_val);
+    return stft;
+}
+
+Eigen::Tensor<float, 2, Eigen::RowMajor> Estimator::compute_istft(const Eigen::Tensor<std::complex<float>, 3, Eigen::RowMajor>& stft) {
+    int num_channels = stft.dimension(0);
+    int num_frames = stft.dimension(1);
+    int wav_length = this->win_length + (num_frames - 1) * this->hop_length;
+    Eigen::Tensor<float, 2, Eigen::RowMajor> wavs(num_channels, wav_length);
+    wavs.setZero();
+    overlap_add(this->stft_engine, stft, wavs.data(), wav_length);
+    return wavs;
+}
+
+void Estimator::overlap_add(StftEngine& engine, const Eigen::Tensor<std::complex<float>, 3, Eigen::RowMajor>& stft, float* wav, Eigen::Index stride) {
+    int num_channels = stft.dimension(0);
+    int num_frames = stft.dimension(1);
+    int num_bins = stft.dimension(2);
+
+    // Bins above F are zero, the engine skips them instead of padding the
+    // spectrum to win_length / 2 + 1 bins, and each windowed frame is added
+    // straight into the output.
+    for (int c = 0; c < num_channels; ++c) {
+        float* channel = wav + c * stride;
+        for (int t = 0; t < num_frames; ++t) {
+            const std::complex<float>* spectrum = stft.data() + (static_cast<Eigen::Index>(c) * num_frames + t) * num_bins;
+            engine.inverse_add(spectrum, num_bins, channel + static_cast<Eigen::Index>(t) * this->hop_length);
+        }
+    }
+}
+
+bool Estimator::complement_last(const std::vector<bool>& wanted) const {
+    return this->options.complementary_stem && wanted.size() > 1 && std::find(wanted.begin(), wanted.end(), false) == wanted.end();
+}
+
+void Estimator::add_mixture(const float* signal, Eigen::Index signal_stride, Eigen::Index num_samples, Eigen::Index offset, int num_frames, float* wav, Eigen::Index stride) const {
+    // The iSTFT of the unmasked full-band STFT is each frame weighted by both
+    // windows, overlap-added without any transform. Frame t reads the signal
+    // from t * hop_length - offset, samples outside [0, num_samples) are zero.
+    int num_channels = this->signal_info.channels;
+    for (int c = 0; c < num_channels; ++c) {
+        const float* x = signal + c * signal_stride;
+        float* out = wav + c * stride;
+        for (int t = 0; t < num_frames; ++t) {
+            Eigen::Index start = static_cast<Eigen::Index>(t) * this->hop_length - offset;
+            Eigen::Index begin = std::max<Eigen::Index>(0, -start);
+            Eigen::Index end = std::min<Eigen::Index>(this->win_length, num_samples - start);
+            float* frame = out + static_cast<Eigen::Index>(t) * this->hop_length;
+            for (Eigen::Index i = begin; i < end; ++i) {
+                frame[i] += x[start + i] * this->win_squared(i);
             }
         }
     }
+}
 
-    return std::make_pair(stft_stereo, mag_stereo);
+void Estimator::subtract_stems(const std::vector<float*>& outputs, Eigen::Index stride, Eigen::Index length) const {
+    int num_channels = this->signal_info.channels;
+    for (int c = 0; c < num_channels; ++c) {
+        float* rest = outputs.back() + c * stride;
+        for (size_t i = 0; i + 1 < outputs.size(); ++i) {
+            const float* wav = outputs[i] + c * stride;
+            for (Eigen::Index j = 0; j < length; ++j) {
+                rest[j] -= wav[j];
+            }
+        }
+    }
 }
 
-Eigen::Tensor<float, 2, Eigen::RowMajor> Estimator::compute_istft(const Eigen::Tensor<float, 4, Eigen::RowMajor>& stft) {
-    // Create a tensor to hold the complex STFT values
-    Eigen::Tensor<std::complex<float>, 3, Eigen::RowMajor> stft_complex(stft.dimension(0), stft.dimension(1), stft.dimension(2));
+void Estimator::for_each_stem(const std::function<void(size_t)>& task) {
+    if (this->stem_pool) {
+        this->stem_pool->run(this->interpreters.size(), task);
+        return;
+    }
+    for (size_t i = 0; i < this->interpreters.size(); ++i) {
+        task(i);
+    }
+}
 
-    // Extract real and imaginary parts and combine into a complex tensor
-    stft_complex = stft.chip<3>(0).cast<std::complex<float>>() + 
-                    stft.chip<3>(1).cast<std::complex<float>>() * std::complex<float>(0, 1);
+void Estimator::check_outputs(const std::vector<char*>& outputs) const {
+    if (outputs.size() != this->stem_names.size()) {
+        throw std::runtime_error("Expected one output buffer per stem.");
+    }
+}
 
-    int pad = (win_length / 2 + 1) - F;
-    assert(stft.dimension(1) + pad != this->win_length);
-    Eigen::Tensor<std::complex<float>, 3, Eigen::RowMajor> padded_stft_complex(stft.dimension(0), stft.dimension(1) + pad, stft.dimension(2));
-    padded_stft_complex.setZero();
-    Eigen::DSizes<Eigen::Index, 3> offsets(0, 0, 0);
-    Eigen::DSizes<Eigen::Index, 3> extents(stft.dimension(0), stft.dimension(1), stft.dimension(2));
-    padded_stft_complex.slice(offsets, extents) = stft_complex;
+std::vector<bool> Estimator::wanted_stems(const std::vector<char*>& outputs) const {
+    std::vector<bool> wanted(this->stem_outputs);
+    for (size_t i = 0; i < wanted.size(); ++i) {
+        wanted[i] = wanted[i] && outputs[i] != nullptr;
+    }
+    return wanted;
+}
 
-    Eigen::FFT<float> fft;
-    Eigen::Tensor<float, 3, Eigen::RowMajor> ifft_result(padded_stft_complex.dimension(0), this->win_length, padded_stft_complex.dimension(2));
-    for (int b = 0; b < padded_stft_complex.dimension(0); ++b) {
-        for (int t = 0; t < padded_stft_complex.dimension(2); ++t) {
-            Eigen::VectorXcf slice(padded_stft_complex.dimension(1));
-            for (int f = 0; f < padded_stft_complex.dimension(1); ++f) {
-                slice(f) = padded_stft_complex(b, f, t);
+MNN::Session* Estimator::create_session(MNN::Interpreter* interpreter, int num_threads) {
+    // Try the forward types in order, the last one is taken even if MNN
+    // replaced it with its own fallback.
+    const std::vector<MNNForwardType>& forward_types = this->options.forward_types;
+    for (size_t i = 0; i < forward_types.size(); ++i) {
+        MNN::ScheduleConfig config;
+        config.type = forward_types[i];
+        if (forward_types[i] == MNN_FORWARD_CPU) {
+            config.numThread = num_threads;
+        } else {
+            config.mode = this->options.gpu_mode;
+        }
+        config.backendConfig = &this->backend_config;
+
+        // Sessions built from one RuntimeInfo share its memory pool
+        MNN::Session* session = nullptr;
+        if (this->options.shared_runtime) {
+            std::pair<int, int> key(config.type, config.type == MNN_FORWARD_CPU ? config.numThread : config.mode);
+            auto runtime = this->runtimes.find(key);
+            if (runtime == this->runtimes.end()) {
+                runtime = this->runtimes.insert(std::make_pair(key, MNN::Interpreter::createRuntime({config}))).first;
             }
+            session = interpreter->createSession(config, runtime->second);
+        } else {
+            session = interpreter->createSession(config);
+        }
+        if (session && (i + 1 == forward_types.size() || session_uses_backend(interpreter, session, forward_types[i]))) {
+            return session;
+        }
+        if (session) {
+            interpreter->releaseSession(session);
+        }
+    }
+
+    return nullptr;
+}
 
-            Eigen::VectorXf ifft_vec(this->win_length);
-            fft.inv(ifft_vec, slice, this->win_length);
-            for (int w = 0; w < this->win_length; ++w) {
-                ifft_result(b, w, t) = ifft_vec(w) * this->win(w);
+int Estimator::session_threads(size_t index) const {
+    return index < this->options.session_threads.size() ? this->options.session_threads[index] : this->options.num_threads;
+}
+
+int Estimator::batch_bucket(int B) const {
+    const std::vector<int>& buckets = this->options.batch_buckets;
+    auto bucket = std::lower_bound(buckets.begin(), buckets.end(), B);
+    return bucket != buckets.end() ? *bucket : B;
+}
+
+MNN::Session* Estimator::prepare_session(size_t index, int B, int segment_frames) {
+    // resizeTensor + resizeSession re-plan memory and re-select kernels, so
+    // each model keeps a few sessions already sized for recent shapes.
+    std::map<std::pair<int, int>, CachedSession>& cache = this->session_cache[index];
+    std::pair<int, int> shape(B, segment_frames);
+    uint64_t use = ++this->session_uses[index];
+    auto cached = cache.find(shape);
+    if (cached != cache.end()) {
+        cached->second.last_use = use;
+        return cached->second.session;
+    }
+
+    // Take the spare session from the constructor, a new one while the
+    // cache has room, or else resize the least recently used one.
+    auto interpreter = this->interpreters[index];
+    MNN::Session* session = this->sessions[index];
+    this->sessions[index] = nullptr;
+    if (!session && static_cast<int>(cache.size()) < this->options.session_cache_size) {
+        session = create_session(interpreter, this->session_threads(index));
+    }
+    if (!session) {
+        auto oldest = cache.begin();
+        for (auto it = cache.begin(); it != cache.end(); ++it) {
+            if (it->second.last_use < oldest->second.last_use) {
+                oldest = it;
             }
         }
+        session = oldest->second.session;
+        cache.erase(oldest);
     }
 
-    int num_batches = ifft_result.dimension(0);
-    int num_frames = ifft_result.dimension(2);
-    int wav_length = this->win_length + (num_frames - 1) * this->hop_length;
-    Eigen::Tensor<float, 2, Eigen::RowMajor> wavs(num_batches, wav_length);
-    wavs.setZero();
+    auto inputTensor = interpreter->getSessionInput(session, this->input_name.c_str());
+    interpreter->resizeTensor(inputTensor, {B, 2, segment_frames, this->F});
+    interpreter->resizeSession(session);
+    this->cache_pending[index] = true;
+    CachedSession entry = {session, use};
+    cache[shape] = entry;
+    return session;
+}
+
+Eigen::Index Estimator::model_offset(Eigen::Index segment, int c, int t, int segment_frames) const {
+    if (this->options.packed_layout) {
+        // NC4HW4: the 2 channels are padded to 4 and interleaved per bin
+        return (segment * segment_frames + t) * this->F * 4 + c;
+    }
+    return ((segment * 2 + c) * segment_frames + t) * this->F;
+}
+
+int Estimator::model_stride() const {
+    return this->options.packed_layout ? 4 : 1;
+}
 
-    for (int b = 0; b < num_batches; ++b) {
+Eigen::Index Estimator::model_segment_size(int segment_frames) const {
+    return static_cast<Eigen::Index>(this->options.packed_layout ? 4 : 2) * segment_frames * this->F;
+}
+
+void Estimator::write_magnitudes(float* frame, const std::complex<float>* spectrum, int c) const {
+    int stride = model_stride();
+    if (spectrum) {
+        for (int f = 0; f < this->F; ++f) {
+            frame[f * stride] = std::abs(spectrum[f]);
+        }
+    } else {
+        for (int f = 0; f < this->F; ++f) {
+            frame[f * stride] = 0.0f;
+        }
+    }
+
+    // The two unused lanes of a packed bin share its cache line, so they are
+    // cleared along with the last channel at no extra memory traffic.
+    if (this->options.packed_layout && c == 1) {
+        for (int f = 0; f < this->F; ++f) {
+            frame[f * stride + 1] = 0.0f;
+            frame[f * stride + 2] = 0.0f;
+        }
+    }
+}
+
+void Estimator::run_models(int B, int segment_frames, const std::function<void(float*)>& write_input, const std::function<void(const std::vector<const float*>&)>& read_outputs, int min_batch) {
+    // The batch runs at its bucket size, or min_batch if larger, the padding
+    // segments are zero and their outputs are never read. The model of a
+    // derived_mask_stem is skipped, its output stays null.
+    int bucket = std::max(batch_bucket(B), min_batch);
+    size_t num_models = this->interpreters.size();
+    std::vector<size_t> models;
+    for (size_t i = 0; i < num_models; ++i) {
+        if (i != this->derived_stem) {
+            models.push_back(i);
+        }
+    }
+    std::vector<MNN::Session*> sessions(num_models, nullptr);
+    for (size_t i : models) {
+        sessions[i] = prepare_session(i, bucket, segment_frames);
+    }
+
+    // The front-end writes straight into the first model's mapped input, the
+    // other models get a copy of it.
+    Eigen::Index segment_size = model_segment_size(segment_frames);
+    MNN::Tensor::DimensionType layout = this->options.packed_layout ? MNN::Tensor::CAFFE_C4 : MNN::Tensor::CAFFE;
+    std::vector<MNN::Tensor*> inputs(num_models);
+    std::vector<float*> input_data(num_models);
+    size_t batch_bytes = bucket * segment_size * sizeof(float);
+    for (size_t i : models) {
+        inputs[i] = this->interpreters[i]->getSessionInput(sessions[i], this->input_name.c_str());
+        if (static_cast<size_t>(inputs[i]->size()) < batch_bytes) {
+            throw std::runtime_error("Model input tensor is smaller than the batch.");
+        }
+        input_data[i] = static_cast<float*>(inputs[i]->map(MNN::Tensor::MAP_TENSOR_WRITE, layout));
+    }
+    float* first_input = input_data[models[0]];
+    write_input(first_input);
+    std::fill(first_input + B * segment_size, first_input + bucket * segment_size, 0.0f);
+    for (size_t k = 1; k < models.size(); ++k) {
+        std::copy(first_input, first_input + bucket * segment_size, input_data[models[k]]);
+    }
+    for (size_t i : models) {
+        inputs[i]->unmap(MNN::Tensor::MAP_TENSOR_WRITE, layout, input_data[i]);
+    }
+
+    // The sessions share no state, so with concurrent_sessions they run side
+    // by side on the stem pool.
+    for_each_stem([&](size_t i) {
+        if (sessions[i]) {
+            this->interpreters[i]->runSession(sessions[i]);
+        }
+    });
+
+    // Persist what a newly sized session tuned, a cache file that cannot be
+    // written is removed so that the next start rebuilds it.
+    for (size_t i : models) {
+        if (!this->cache_pending[i] || i >= this->options.cache_files.size() || this->options.cache_files[i].empty()) {
+            continue;
+        }
+        this->cache_pending[i] = false;
+        if (this->interpreters[i]->updateCacheFile(sessions[i]) != MNN::NO_ERROR) {
+            std::remove(this->options.cache_files[i].c_str());
+        }
+    }
+
+    // The mask stage reads the outputs in place
+    std::vector<MNN::Tensor*> outputs(num_models);
+    std::vector<const float*> output_data(num_models, nullptr);
+    for (size_t i : models) {
+        outputs[i] = this->interpreters[i]->getSessionOutput(sessions[i], this->output_name.c_str());
+        if (static_cast<size_t>(outputs[i]->size()) < batch_bytes) {
+            throw std::runtime_error("Model output tensor is smaller than the batch.");
+        }
+        output_data[i] = static_cast<const float*>(outputs[i]->map(MNN::Tensor::MAP_TENSOR_READ, layout));
+    }
+    read_outputs(output_data);
+    for (size_t i : models) {
+        outputs[i]->unmap(MNN::Tensor::MAP_TENSOR_READ, layout, const_cast<float*>(output_data[i]));
+    }
+}
+
+int Estimator::tail_frames(int num_frames, int segment_frames) const {
+    // The UNet takes any multiple of 64 frames
+    if (!this->options.right_size_tail) {
+        return segment_frames;
+    }
+    int tail = num_frames - (num_frames - 1) / segment_frames * segment_frames;
+    return (tail + 63) / 64 * 64;
+}
+
+void Estimator::copy_segment(const float* src, int src_frames, float* dst, int dst_frames, int num_frames) const {
+    // Frames of one segment between two segment lengths, a packed frame
+    // holds both channels.
+    int num_planes = this->options.packed_layout ? 1 : 2;
+    Eigen::Index frame_size = static_cast<Eigen::Index>(this->F) * model_stride();
+    for (int c = 0; c < num_planes; ++c) {
         for (int t = 0; t < num_frames; ++t) {
-            int start = t * this->hop_length;
-            int end = start + this->win_length;
-            for (int w = start; w < end; ++w) {
-                wavs(b, w) += ifft_result(b, w - start, t);
+            const float* frame = src + model_offset(0, c, t, src_frames);
+            std::copy(frame, frame + frame_size, dst + model_offset(0, c, t, dst_frames));
+        }
+    }
+}
+
+bool Estimator::silent_segment(const float* segment, int segment_frames) const {
+    // Padded frames are zero and never the loudest
+    int stride = model_stride();
+    for (int t = 0; t < segment_frames; ++t) {
+        float energy = 0.0f;
+        for (int c = 0; c < 2; ++c) {
+            const float* frame = segment + model_offset(0, c, t, segment_frames);
+            for (int f = 0; f < this->F; ++f) {
+                energy += frame[f * stride] * frame[f * stride];
             }
         }
+        if (energy >= this->silence_energy) {
+            return false;
+        }
     }
+    return true;
+}
 
-    return wavs;
+void Estimator::fill_silent(std::vector<std::vector<float>>& masks, Eigen::Index size, Eigen::Index offset, Eigen::Index count) const {
+    // Equal masks split the mixture evenly, a derived mask then gets the
+    // same share.
+    float share = 1.0f / masks.size();
+    for (size_t i = 0; i < masks.size(); ++i) {
+        if (i != this->derived_stem) {
+            masks[i].resize(size);
+            std::fill(masks[i].begin() + offset, masks[i].begin() + offset + count, share);
+        }
+    }
+}
+
+void Estimator::infer_segments(int B, int segment_frames, int tail, const float* magnitudes, std::vector<std::vector<float>>& masks) {
+    // B segments laid out for segment_frames in magnitudes, the masks are
+    // gathered in the same layout. Silent segments skip the models. The
+    // others go in batches of max_batch through one session sized for them,
+    // the last one padded; a right-sized last segment runs on its own at tail
+    // frames.
+    Eigen::Index segment_size = model_segment_size(segment_frames);
+    bool gate = this->options.silence_threshold_db < 0.0f;
+    masks.assign(this->interpreters.size(), std::vector<float>());
+    int full = tail < segment_frames ? B - 1 : B;
+    std::vector<bool> silent(B, false);
+    std::vector<int> active;
+    for (int s = 0; s < B; ++s) {
+        silent[s] = gate && silent_segment(magnitudes + s * segment_size, segment_frames);
+        if (silent[s]) {
+            fill_silent(masks, B * segment_size, s * segment_size, segment_size);
+        } else if (s < full) {
+            active.push_back(s);
+        }
+    }
+    if (gate) {
+        this->num_gated += B;
+        this->num_skipped += std::count(silent.begin(), silent.end(), true);
+    }
+
+    int num_active = static_cast<int>(active.size());
+    int max_batch = this->options.max_batch > 0 ? this->options.max_batch : num_active;
+    for (int first = 0; first < num_active; first += max_batch) {
+        int count = std::min(max_batch, num_active - first);
+        run_models(count, segment_frames, [&](float* mag) {
+            for (int k = 0; k < count; ++k) {
+                const float* segment = magnitudes + active[first + k] * segment_size;
+                std::copy(segment, segment + segment_size, mag + k * segment_size);
+            }
+        }, [&](const std::vector<const float*>& outputs) {
+            for (size_t i = 0; i < outputs.size(); ++i) {
+                if (outputs[i]) {
+                    masks[i].resize(B * segment_size);
+                    for (int k = 0; k < count; ++k) {
+                        const float* mask = outputs[i] + k * segment_size;
+                        std::copy(mask, mask + segment_size, masks[i].begin() + active[first + k] * segment_size);
+                    }
+                }
+            }
+        }, this->options.max_batch > 0 ? batch_bucket(max_batch) : 0);
+    }
+
+    if (full < B && !silent[full]) {
+        const float* last = magnitudes + full * segment_size;
+        run_models(1, tail, [&](float* mag) {
+            copy_segment(last, segment_frames, mag, tail, tail);
+        }, [&](const std::vector<const float*>& outputs) {
+            for (size_t i = 0; i < outputs.size(); ++i) {
+                if (outputs[i]) {
+                    masks[i].resize(B * segment_size);
+                    copy_segment(outputs[i], tail, masks[i].data() + full * segment_size, segment_frames, tail);
+                }
+            }
+        });
+    }
+}
+
+std::vector<Eigen::Tensor<std::complex<float>, 3, Eigen::RowMajor>> Estimator::apply_masks(const Eigen::Tensor<std::complex<float>, 3, Eigen::RowMajor>& stft, const std::vector<const float*>& masks, int segment_frames, const std::vector<bool>& wanted) {
+    int num_channels = stft.dimension(0);
+    int num_frames = stft.dimension(1);
+    size_t num_stems = masks.size();
+
+    // The normalization needs every mask, but only the wanted stems are
+    // scaled and stored.
+    std::vector<size_t> scaled;
+    std::vector<Eigen::Tensor<std::complex<float>, 3, Eigen::RowMajor>> stft_masked(num_stems);
+    for (size_t i = 0; i < num_stems; ++i) {
+        if (wanted.empty() || wanted[i]) {
+            stft_masked[i].resize(num_channels, num_frames, this->F);
+            scaled.push_back(i);
+        }
+    }
+
+    // One pass over the {B, C, T, F} model outputs: square, normalize over the
+    // stems and scale the matching C x L x F spectrum bin. Padded frames of the
+    // last segment are never read. A stem without a model output takes what
+    // the other masks leave of 1.
+    int stride = model_stride();
+    size_t derived = std::find(masks.begin(), masks.end(), nullptr) - masks.begin();
+    std::vector<float> squares(num_stems);
+    for (int c = 0; c < num_channels; ++c) {
+        for (int j = 0; j < num_frames; ++j) {
+            Eigen::Index mask_offset = model_offset(j / segment_frames, c, j % segment_frames, segment_frames);
+            Eigen::Index stft_offset = (static_cast<Eigen::Index>(c) * num_frames + j) * this->F;
+            for (int f = 0; f < this->F; ++f) {
+                float mask_sum = 0.0f;
+                float mask_total = 0.0f;
+                for (size_t i = 0; i < num_stems; ++i) {
+                    if (i == derived) {
+                        continue;
+                    }
+                    float m = masks[i][mask_offset + f * stride];
+                    squares[i] = m * m;
+                    mask_sum += squares[i];
+                    mask_total += m;
+                }
+                if (derived < num_stems) {
+                    float m = std::max(0.0f, 1.0f - mask_total);
+                    squares[derived] = m * m;
+                    mask_sum += squares[derived];
+                }
+                mask_sum += 1e-10f;
+
+                const std::complex<float>& bin = stft.data()[stft_offset + f];
+                for (size_t i : scaled) {
+                    stft_masked[i].data()[stft_offset + f] = bin * ((squares[i] + (1e-10f / 2)) / mask_sum);
+                }
+            }
+        }
+    }
+
+    return stft_masked;
 }
 
 size_t Estimator::addFrames(char *in, size_t byte_size) {
@@ -245,117 +822,638 @@ size_t Estimator::addFrames(char *in, size_t byte_size) {
 }
 
 size_t Estimator::separate(char *out_1, char *out_2) {
-    auto stft_result = compute_stft(this->wav);
-    auto stft = stft_result.first;
-    auto stft_mag = stft_result.second;
-
-    int L = stft.dimension(2);
-
-    Eigen::DSizes<Eigen::Index, 4> broadcast_dims(1, 1, 1, 1);
-    Eigen::Tensor<float, 4, Eigen::RowMajor> stft_mag_4d = stft_mag.reshape(Eigen::DSizes<Eigen::Index, 4>{stft_mag.dimension(0), stft_mag.dimension(1), stft_mag.dimension(2), 1}).broadcast(broadcast_dims);
-    Eigen::DSizes<Eigen::Index, 4> shuffle_dims({3, 0, 1, 2});
-    Eigen::Tensor<float, 4, Eigen::RowMajor> stft_mag_trans = stft_mag_4d.shuffle(shuffle_dims);
-    Eigen::Tensor<float, 4, Eigen::RowMajor> stft_mag_padded = pad_and_partition(stft_mag_trans, this->T);
-    shuffle_dims = {0, 1, 3, 2};
-    Eigen::Tensor<float, 4, Eigen::RowMajor> stft_mag_trans_final = stft_mag_padded.shuffle(shuffle_dims);
-
-    int B = stft_mag_trans_final.dimension(0);
-    // Compute masks for each instrument using the neural network
-    std::vector<Eigen::Tensor<float, 4, Eigen::RowMajor>> masks;
-    for (size_t i = 0; i < this->interpreters.size(); ++i) {
-        auto interpreter = this->interpreters[i];
-        auto session = this->sessions[i];
+    std::vector<char*> outputs = {out_1, out_2};
+    return separate(outputs);
+}
 
-        auto inputTensor = interpreter->getSessionInput(session, INPUT_NAME);
-        interpreter->resizeTensor(inputTensor, {B, 2, this->T, this->F});
-        interpreter->resizeSession(session);
-        auto outputTensor = interpreter->getSessionOutput(session, OUTPUT_NAME);
-        auto tmp_input = MNN::Tensor::create<float>({B, 2, this->T, this->F}, stft_mag_trans_final.data(), MNN::Tensor::CAFFE);
-    
-        inputTensor->copyFromHostTensor(tmp_input);
-    
-        interpreter->runSession(session);
+size_t Estimator::separate(const std::vector<char*>& outputs) {
+    check_outputs(outputs);
+    std::vector<bool> wanted = wanted_stems(outputs);
+    bool complement = complement_last(wanted);
+    std::vector<bool> masked(wanted);
+    if (complement) {
+        masked.back() = false;
+    }
+    int L = this->stft_engine.num_frames(this->wav.dimension(1));
+    int B = (L + this->T - 1) / this->T;
 
-        Eigen::Tensor<float, 4> zeros(B, 2, this->T, this->F);
-        zeros.setZero();
-        auto tmp_output = MNN::Tensor::create<float>({B, 2, this->T, this->F}, zeros.data(), MNN::Tensor::CAFFE);
-        outputTensor->copyToHostTensor(tmp_output);
-        Eigen::TensorMap<Eigen::Tensor<float, 4, Eigen::RowMajor>> tensorMap(tmp_output->host<float>(), B, 2, this->T, this->F);
-        Eigen::Tensor<float, 4, Eigen::RowMajor> mask(B, 2, this->T, this->F);
-        mask = tensorMap;
-        masks.push_back(mask);
+    // Compute masks for each instrument using the neural network. The
+    // front-end writes magnitudes straight into the {B, 2, T, F} model input
+    // and the masks are applied straight from the model outputs.
+    Eigen::Tensor<std::complex<float>, 3, Eigen::RowMajor> stft;
+    std::vector<Eigen::Tensor<std::complex<float>, 3, Eigen::RowMajor>> stft_masked;
+    int max_batch = this->options.max_batch;
+    int tail = tail_frames(L, this->T);
+    if ((max_batch > 0 && B > max_batch) || tail < this->T || this->options.silence_threshold_db < 0.0f) {
+        std::vector<float> magnitudes(B * model_segment_size(this->T));
+        stft = compute_stft(this->wav, magnitudes.data());
+        std::vector<std::vector<float>> masks;
+        infer_segments(B, this->T, tail, magnitudes.data(), masks);
+        std::vector<const float*> mask_data;
+        for (const auto& mask : masks) {
+            mask_data.push_back(mask.empty() ? nullptr : mask.data());
+        }
+        stft_masked = apply_masks(stft, mask_data, this->T, masked);
+    } else {
+        run_models(B, this->T, [&](float* mag) {
+            stft = compute_stft(this->wav, mag);
+        }, [&](const std::vector<const float*>& masks) {
+            stft_masked = apply_masks(stft, masks, this->T, masked);
+        });
+    }
 
-        delete tmp_input;
-        delete tmp_output;
+    // Each stem runs its own iSTFT engine. With complementary_stem the last
+    // stem is the mixture reconstruction minus all the others.
+    AudioDataFormat format = this->signal_info.data_format;
+    size_t num_channels = this->signal_info.channels;
+    Eigen::Index num_samples = this->win_length + static_cast<Eigen::Index>(L - 1) * this->hop_length;
+    std::vector<std::vector<float>> wavs(outputs.size());
+    std::vector<float*> stem_wavs(outputs.size(), nullptr);
+    for (size_t i = 0; i < outputs.size(); ++i) {
+        if (wanted[i]) {
+            wavs[i].assign(num_channels * num_samples, 0.0f);
+            stem_wavs[i] = wavs[i].data();
+        }
+    }
+    for_each_stem([&](size_t i) {
+        if (!wanted[i]) {
+            return;
+        }
+        if (complement && i + 1 == outputs.size()) {
+            add_mixture(this->wav.data(), this->wav.dimension(1), this->wav.dimension(1), this->win_length / 2, L, stem_wavs[i], num_samples);
+        } else {
+            overlap_add(this->stem_engines[i], stft_masked[i], stem_wavs[i], num_samples);
+        }
+    });
+    if (complement) {
+        subtract_stems(stem_wavs, num_samples, num_samples);
     }
 
-    Eigen::Tensor<float, 4, Eigen::RowMajor> mask_sum = masks[0].square();
-    mask_sum += masks[1].square();
-    mask_sum = mask_sum + 1e-10f;
+    for_each_stem([&](size_t i) {
+        if (!wanted[i]) {
+            return;
+        }
+        for (Eigen::Index j = 0; j < num_samples; ++j) {
+            for (size_t c = 0; c < num_channels; ++c) {
+                write_sample(outputs[i], format, j * num_channels + c, stem_wavs[i][c * num_samples + j]);
+            }
+        }
+    });
 
-    std::vector<Eigen::Tensor<float, 2, Eigen::RowMajor>> wavs;
-    for (auto& mask : masks) {
-        mask = (mask.square() + (1e-10f / 2)) / mask_sum;
+    return num_samples * num_channels * (format == PCM_16BIT ? sizeof(short) : sizeof(float));
+}
 
-        Eigen::DSizes<Eigen::Index, 4> shuffle_dims(0, 1, 3, 2);
-        Eigen::Tensor<float, 4, Eigen::RowMajor> mask_trans = mask.shuffle(shuffle_dims);
+void Estimator::separate_chunk(const float* input, Eigen::Index input_stride, int num_frames, int segment_frames, const std::vector<float*>& outputs, Eigen::Index output_stride) {
+    int B = (num_frames + segment_frames - 1) / segment_frames;
+    Eigen::Tensor<std::complex<float>, 3, Eigen::RowMajor> stft(this->signal_info.channels, num_frames, this->F);
+    int tail = tail_frames(num_frames, segment_frames);
+    if (tail < segment_frames || this->options.silence_threshold_db < 0.0f) {
+        std::vector<float> magnitudes(B * model_segment_size(segment_frames));
+        chunk_front_end(input, input_stride, num_frames, segment_frames, stft, magnitudes.data(), this->stft_engine);
+        std::vector<std::vector<float>> masks;
+        infer_segments(B, segment_frames, tail, magnitudes.data(), masks);
+        std::vector<const float*> mask_data;
+        for (const auto& mask : masks) {
+            mask_data.push_back(mask.empty() ? nullptr : mask.data());
+        }
+        chunk_back_end(input, input_stride, stft, mask_data, segment_frames, outputs, output_stride, nullptr);
+        return;
+    }
 
-        std::vector<Eigen::Tensor<float, 4, Eigen::RowMajor>> splits;
-        for (int i = 0; i < mask_trans.dimension(0); ++i) {
-            Eigen::DSizes<Eigen::Index, 4> new_shape(1, mask_trans.dimension(1), mask_trans.dimension(2), mask_trans.dimension(3));
-            splits.push_back(mask_trans.chip(i, 0).reshape(new_shape));
+    run_models(B, segment_frames, [&](float* mag) {
+        chunk_front_end(input, input_stride, num_frames, segment_frames, stft, mag, this->stft_engine);
+    }, [&](const std::vector<const float*>& masks) {
+        chunk_back_end(input, input_stride, stft, masks, segment_frames, outputs, output_stride, nullptr);
+    });
+}
+
+void Estimator::chunk_front_end(const float* input, Eigen::Index input_stride, int num_frames, int segment_frames, Eigen::Tensor<std::complex<float>, 3, Eigen::RowMajor>& stft, float* mag, StftEngine& engine) const {
+    // Frame j of channel c starts at input + c * input_stride + j * hop_length,
+    // the centering zeros are already in the input.
+    int num_channels = this->signal_info.channels;
+    int B = (num_frames + segment_frames - 1) / segment_frames;
+    for (int c = 0; c < num_channels; ++c) {
+        for (int j = 0; j < B * segment_frames; ++j) {
+            float* mag_frame = mag + model_offset(j / segment_frames, c, j % segment_frames, segment_frames);
+            if (j >= num_frames) {
+                write_magnitudes(mag_frame, nullptr, c);
+                continue;
+            }
+
+            std::complex<float>* spectrum = stft.data() + (static_cast<Eigen::Index>(c) * num_frames + j) * this->F;
+            engine.forward(input + c * input_stride + static_cast<Eigen::Index>(j) * this->hop_length, spectrum, this->F);
+            write_magnitudes(mag_frame, spectrum, c);
         }
+    }
+}
 
-        Eigen::Tensor<float, 4, Eigen::RowMajor> mask_concat(splits[0].dimension(0), splits[0].dimension(1), splits[0].dimension(2), B * splits[0].dimension(3));
-        for (int i = 0; i < mask.dimension(0); ++i) {
-            Eigen::DSizes<Eigen::Index, 4> offset(0, 0, 0, i * splits[0].dimension(3));
-            mask_concat.slice(offset, splits[i].dimensions()) = splits[i];
+void Estimator::chunk_back_end(const float* input, Eigen::Index input_stride, const Eigen::Tensor<std::complex<float>, 3, Eigen::RowMajor>& stft, const std::vector<const float*>& masks, int segment_frames, const std::vector<float*>& outputs, Eigen::Index output_stride, StftEngine* engine) {
+    int num_frames = stft.dimension(1);
+    std::vector<bool> wanted;
+    for (float* output : outputs) {
+        wanted.push_back(output != nullptr);
+    }
+    bool complement = complement_last(wanted);
+    std::vector<bool> masked(wanted);
+    if (complement) {
+        masked.back() = false;
+    }
+    std::vector<Eigen::Tensor<std::complex<float>, 3, Eigen::RowMajor>> stft_masked = apply_masks(stft, masks, segment_frames, masked);
+
+    // Overlap-add onto whatever the previous chunk left in outputs, stems
+    // without an output are skipped. With complementary_stem the last output
+    // accumulates the mixture reconstruction, the caller subtracts the other
+    // stems from the completed samples. Given an engine the stems run one
+    // after the other on it, otherwise on the stem pool with their own.
+    Eigen::Index length = static_cast<Eigen::Index>(num_frames - 1) * this->hop_length + this->win_length;
+    std::function<void(size_t)> synthesize = [&](size_t i) {
+        if (!outputs[i]) {
+            return;
+        }
+        if (complement && i + 1 == outputs.size()) {
+            add_mixture(input, input_stride, length, 0, num_frames, outputs[i], output_stride);
+        } else {
+            overlap_add(engine ? *engine : this->stem_engines[i], stft_masked[i], outputs[i], output_stride);
         }
+    };
+    if (engine) {
+        for (size_t i = 0; i < outputs.size(); ++i) {
+            synthesize(i);
+        }
+    } else {
+        for_each_stem(synthesize);
+    }
+}
 
-        Eigen::DSizes<Eigen::Index, 3> new_shape(mask_concat.dimension(1), mask_concat.dimension(2), mask_concat.dimension(3));
-        Eigen::Tensor<float, 3, Eigen::RowMajor> mask_reshaped = mask_concat.reshape(new_shape);
-        Eigen::DSizes<Eigen::Index, 3> offsets(0, 0, 0);
-        Eigen::DSizes<Eigen::Index, 3> extents(mask_reshaped.dimension(0), mask_reshaped.dimension(1), L);
-        Eigen::Tensor<float, 3, Eigen::RowMajor> mask_sliced = mask_reshaped.slice(offsets, extents);
-        Eigen::DSizes<Eigen::Index, 4> new_dims(mask_sliced.dimension(0), mask_sliced.dimension(1), mask_sliced.dimension(2), 1);
-        Eigen::Tensor<float, 4, Eigen::RowMajor> mask_expanded = mask_sliced.reshape(new_dims);
+void Estimator::run_pipeline(int64_t num_frames, int chunk_frames, Eigen::Index window_length, const std::function<void(int64_t, int, float*)>& read_window, const std::vector<float*>& outputs, const std::function<void(int64_t, int)>& finish_chunk) {
+    // The front-end of chunk n + 1, the inference of chunk n and the masks
+    // and overlap-add of chunk n - 1 run at the same time. The inference
+    // stage keeps the calling thread and the stem pool; the last stage runs
+    // the stems one after the other on its own engine and, being the only
+    // consumer, completes the chunks in order so the seams are carried over
+    // as in the plain chunked path. A null chunk ends the stream.
+    typedef std::unique_ptr<PipelineChunk> Chunk;
+    size_t num_channels = this->signal_info.channels;
+    Eigen::Index segment_size = model_segment_size(this->T);
+    BoundedQueue<Chunk> analyzed(this->options.pipeline_depth);
+    BoundedQueue<Chunk> inferred(this->options.pipeline_depth);
 
-        Eigen::Tensor<float, 4, Eigen::RowMajor> stft_masked = stft * mask_expanded.broadcast(Eigen::DSizes<Eigen::Index, 4>{1, 1, 1, stft.dimension(3)});
+    // The first error stops the front-end; every stage still ends its queue
+    // with the null chunk and drains its input, so no stage blocks and both
+    // threads are joined before the error is rethrown.
+    std::mutex error_mutex;
+    std::exception_ptr error;
+    std::atomic<bool> failed(false);
+    auto fail = [&]() {
+        std::lock_guard<std::mutex> lock(error_mutex);
+        if (!error) {
+            error = std::current_exception();
+        }
+        failed = true;
+    };
+    struct Joiner {
+        std::thread& thread;
+        ~Joiner() {
+            if (thread.joinable()) {
+                thread.join();
+            }
+        }
+    };
 
-        Eigen::Tensor<float, 2, Eigen::RowMajor> wav_masked = compute_istft(stft_masked);
+    std::thread front_end;
+    Joiner front_end_joiner = {front_end};
+    try {
+        front_end = std::thread([&]() {
+            try {
+                for (int64_t first = 0; first < num_frames && !failed; first += chunk_frames) {
+                    Chunk chunk(new PipelineChunk());
+                    chunk->first = first;
+                    chunk->num_frames = static_cast<int>(std::min<int64_t>(chunk_frames, num_frames - first));
+                    int B = (chunk->num_frames + this->T - 1) / this->T;
+                    chunk->input.resize(num_channels * window_length);
+                    read_window(first, chunk->num_frames, chunk->input.data());
+                    chunk->stft.resize(num_channels, chunk->num_frames, this->F);
+                    chunk->magnitudes.resize(B * segment_size);
+                    chunk_front_end(chunk->input.data(), window_length, chunk->num_frames, this->T, chunk->stft, chunk->magnitudes.data(), this->stft_engine);
+                    analyzed.push(std::move(chunk));
+                }
+            } catch (...) {
+                fail();
+            }
+            analyzed.push(Chunk());
+        });
+    } catch (...) {
+        fail();
+        analyzed.push(Chunk());
+    }
 
-        wavs.push_back(wav_masked);
+    std::thread back_end;
+    Joiner back_end_joiner = {back_end};
+    try {
+        back_end = std::thread([&]() {
+            StftEngine engine(this->stft_engine);
+            for (Chunk chunk = inferred.pop(); chunk; chunk = inferred.pop()) {
+                if (failed) {
+                    continue;
+                }
+                try {
+                    std::vector<const float*> masks;
+                    for (const auto& mask : chunk->masks) {
+                        masks.push_back(mask.empty() ? nullptr : mask.data());
+                    }
+                    chunk_back_end(chunk->input.data(), window_length, chunk->stft, masks, this->T, outputs, window_length, &engine);
+                    finish_chunk(chunk->first, chunk->num_frames);
+                } catch (...) {
+                    fail();
+                }
+            }
+        });
+    } catch (...) {
+        fail();
     }
 
-    size_t num_samples = wavs[0].dimension(1);
-    size_t byte_size = num_samples * this->signal_info.channels * (this->signal_info.data_format == PCM_16BIT ? sizeof(short) : sizeof(float));
-    if (this->signal_info.data_format == PCM_16BIT) {
-        short *wav_1 = new short[this->signal_info.channels * num_samples];
-        short *wav_2 = new short[this->signal_info.channels * num_samples];
-        for (size_t j = 0; j < num_samples; ++j) {
-            wav_1[this->signal_info.channels * j] = static_cast<short>(wavs[0](0, j) *  INT16_MAX);
-            wav_1[this->signal_info.channels * j + 1] = static_cast<short>(wavs[0](1, j) *  INT16_MAX);
-            wav_2[this->signal_info.channels * j] = static_cast<short>(wavs[1](0, j) *  INT16_MAX);
-            wav_2[this->signal_info.channels * j + 1] = static_cast<short>(wavs[1](1, j) *  INT16_MAX);
-        }
-        memcpy(out_1, wav_1, byte_size);
-        delete[] wav_1;
-        memcpy(out_2, wav_2, byte_size);
-        delete[] wav_2;
-    } else if (this->signal_info.data_format == PCM_FLOAT32) {
-        float *wav_1 = new float[this->signal_info.channels * num_samples];
-        float *wav_2 = new float[this->signal_info.channels * num_samples];
-        for (size_t j = 0; j < num_samples; ++j) {
-            wav_1[this->signal_info.channels * j] = wavs[0](0, j);
-            wav_1[this->signal_info.channels * j + 1] = wavs[0](1, j);
-            wav_2[this->signal_info.channels * j] = wavs[1](0, j);
-            wav_2[this->signal_info.channels * j + 1] = wavs[1](1, j);
+    // The model outputs are copied out, the sessions are needed for the next
+    // chunk while this one is still being masked.
+    for (Chunk chunk = analyzed.pop(); chunk; chunk = analyzed.pop()) {
+        if (failed) {
+            continue;
+        }
+        try {
+            int B = (chunk->num_frames + this->T - 1) / this->T;
+            infer_segments(B, this->T, tail_frames(chunk->num_frames, this->T), chunk->magnitudes.data(), chunk->masks);
+            inferred.push(std::move(chunk));
+        } catch (...) {
+            fail();
         }
-        memcpy(out_1, wav_1, byte_size);
-        delete[] wav_1;
-        memcpy(out_2, wav_2, byte_size);
-        delete[] wav_2;
     }
+    inferred.push(Chunk());
 
-    return byte_size;
+    if (front_end.joinable()) {
+        front_end.join();
+    }
+    if (back_end.joinable()) {
+        back_end.join();
+    }
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+size_t Estimator::separate(const char *in, size_t byte_size, char *out_1, char *out_2) {
+    std::vector<char*> outputs = {out_1, out_2};
+    return separate(in, byte_size, outputs);
+}
+
+size_t Estimator::separate(const char *in, size_t byte_size, const std::vector<char*>& out) {
+    check_outputs(out);
+    AudioDataFormat format = this->signal_info.data_format;
+    size_t num_channels = this->signal_info.channels;
+    size_t sample_size = format == PCM_16BIT ? sizeof(short) : sizeof(float);
+    int64_t num_samples = byte_size / (sample_size * num_channels);
+    int64_t num_frames = 1 + num_samples / this->hop_length;
+    int64_t overlap = this->win_length - this->hop_length;
+
+    // Frames are taken T-aligned so that every chunk feeds the models the
+    // same segments as the whole-file path. A chunk of K frames reads
+    // (K - 1) * hop_length + win_length input samples and completes the
+    // first K * hop_length output samples, the last win_length - hop_length
+    // still get contributions from the next chunk and are carried over.
+    int chunk_frames = this->options.chunk_segments * this->T;
+    Eigen::Index window_length = static_cast<Eigen::Index>(chunk_frames - 1) * this->hop_length + this->win_length;
+    std::vector<bool> wanted = wanted_stems(out);
+    std::vector<std::vector<float>> accumulators(this->interpreters.size());
+    std::vector<float*> outputs;
+    for (size_t i = 0; i < accumulators.size(); ++i) {
+        if (wanted[i]) {
+            accumulators[i].assign(num_channels * window_length, 0.0f);
+        }
+        outputs.push_back(wanted[i] ? accumulators[i].data() : nullptr);
+    }
+
+    auto read_window = [&](int64_t first, int K, float* input) {
+        Eigen::Index length = static_cast<Eigen::Index>(K - 1) * this->hop_length + this->win_length;
+        int64_t start = first * this->hop_length - this->win_length / 2;
+        for (size_t c = 0; c < num_channels; ++c) {
+            float* channel = input + c * window_length;
+            for (Eigen::Index i = 0; i < length; ++i) {
+                int64_t index = start + i;
+                channel[i] = (index >= 0 && index < num_samples) ? read_sample(in, format, index * num_channels + c) : 0.0f;
+            }
+        }
+    };
+
+    // Write out the completed samples, everything on the last chunk, and
+    // carry the rest over to the next chunk
+    auto finish_chunk = [&](int64_t first, int K) {
+        bool last = first + K >= num_frames;
+        Eigen::Index length = static_cast<Eigen::Index>(K - 1) * this->hop_length + this->win_length;
+        Eigen::Index done = last ? length : static_cast<Eigen::Index>(K) * this->hop_length;
+        if (complement_last(wanted)) {
+            subtract_stems(outputs, window_length, done);
+        }
+        size_t offset = first * this->hop_length;
+        for (size_t i = 0; i < accumulators.size(); ++i) {
+            for (size_t c = 0; wanted[i] && c < num_channels; ++c) {
+                const float* wav = accumulators[i].data() + c * window_length;
+                for (Eigen::Index j = 0; j < done; ++j) {
+                    write_sample(out[i], format, (offset + j) * num_channels + c, wav[j]);
+                }
+            }
+        }
+        for (size_t i = 0; !last && i < accumulators.size(); ++i) {
+            for (size_t c = 0; wanted[i] && c < num_channels; ++c) {
+                float* wav = accumulators[i].data() + c * window_length;
+                std::copy(wav + done, wav + done + overlap, wav);
+                std::fill(wav + overlap, wav + window_length, 0.0f);
+            }
+        }
+    };
+
+    if (this->options.pipeline_depth > 0) {
+        run_pipeline(num_frames, chunk_frames, window_length, read_window, outputs, finish_chunk);
+    } else {
+        std::vector<float> input(num_channels * window_length);
+        for (int64_t first = 0; first < num_frames; first += chunk_frames) {
+            int K = static_cast<int>(std::min<int64_t>(chunk_frames, num_frames - first));
+            read_window(first, K, input.data());
+            separate_chunk(input.data(), window_length, K, this->T, outputs, window_length);
+            finish_chunk(first, K);
+        }
+    }
+
+    return (this->win_length + (num_frames - 1) * this->hop_length) * num_channels * sample_size;
+}
+
+size_t Estimator::separate_request(const char* in, size_t byte_size, const std::vector<char*>& out, const std::function<void(int, const float*, std::vector<std::vector<float>>&)>& infer) {
+    // The whole input as one chunk, on engines of its own, so that many
+    // requests can run their front-end and synthesis at the same time while
+    // infer() hands their segments to whoever runs the models.
+    check_outputs(out);
+    AudioDataFormat format = this->signal_info.data_format;
+    size_t num_channels = this->signal_info.channels;
+    size_t sample_size = format == PCM_16BIT ? sizeof(short) : sizeof(float);
+    int64_t num_samples = byte_size / (sample_size * num_channels);
+    int num_frames = static_cast<int>(1 + num_samples / this->hop_length);
+    int B = (num_frames + this->T - 1) / this->T;
+    Eigen::Index length = static_cast<Eigen::Index>(num_frames - 1) * this->hop_length + this->win_length;
+
+    std::vector<float> input(num_channels * length);
+    int64_t start = -this->win_length / 2;
+    for (size_t c = 0; c < num_channels; ++c) {
+        float* channel = input.data() + c * length;
+        for (Eigen::Index i = 0; i < length; ++i) {
+            int64_t index = start + i;
+            channel[i] = (index >= 0 && index < num_samples) ? read_sample(in, format, index * num_channels + c) : 0.0f;
+        }
+    }
+
+    StftEngine engine(this->stft_engine);
+    Eigen::Tensor<std::complex<float>, 3, Eigen::RowMajor> stft(num_channels, num_frames, this->F);
+    std::vector<float> magnitudes(B * model_segment_size(this->T));
+    chunk_front_end(input.data(), length, num_frames, this->T, stft, magnitudes.data(), engine);
+
+    // Only the segments that are not silent are handed to infer()
+    Eigen::Index segment_size = model_segment_size(this->T);
+    std::vector<std::vector<float>> masks(this->interpreters.size());
+    if (this->options.silence_threshold_db < 0.0f) {
+        std::vector<int> active;
+        for (int s = 0; s < B; ++s) {
+            if (silent_segment(magnitudes.data() + s * segment_size, this->T)) {
+                fill_silent(masks, B * segment_size, s * segment_size, segment_size);
+            } else {
+                active.push_back(s);
+            }
+        }
+        this->num_gated += B;
+        this->num_skipped += B - active.size();
+
+        int num_active = static_cast<int>(active.size());
+        std::vector<float> active_magnitudes(num_active * segment_size);
+        for (int k = 0; k < num_active; ++k) {
+            std::copy(magnitudes.begin() + active[k] * segment_size, magnitudes.begin() + (active[k] + 1) * segment_size, active_magnitudes.begin() + k * segment_size);
+        }
+        std::vector<std::vector<float>> active_masks(this->interpreters.size());
+        if (num_active > 0) {
+            infer(num_active, active_magnitudes.data(), active_masks);
+        }
+        for (size_t i = 0; i < active_masks.size(); ++i) {
+            for (int k = 0; k < num_active && !active_masks[i].empty(); ++k) {
+                masks[i].resize(B * segment_size);
+                std::copy(active_masks[i].begin() + k * segment_size, active_masks[i].begin() + (k + 1) * segment_size, masks[i].begin() + active[k] * segment_size);
+            }
+        }
+    } else {
+        infer(B, magnitudes.data(), masks);
+    }
+    std::vector<const float*> mask_data;
+    for (const auto& mask : masks) {
+        mask_data.push_back(mask.empty() ? nullptr : mask.data());
+    }
+
+    std::vector<bool> wanted = wanted_stems(out);
+    std::vector<std::vector<float>> wavs(this->interpreters.size());
+    std::vector<float*> outputs;
+    for (size_t i = 0; i < wavs.size(); ++i) {
+        if (wanted[i]) {
+            wavs[i].assign(num_channels * length, 0.0f);
+        }
+        outputs.push_back(wanted[i] ? wavs[i].data() : nullptr);
+    }
+    chunk_back_end(input.data(), length, stft, mask_data, this->T, outputs, length, &engine);
+    if (complement_last(wanted)) {
+        subtract_stems(outputs, length, length);
+    }
+    for (size_t i = 0; i < wavs.size(); ++i) {
+        for (size_t c = 0; wanted[i] && c < num_channels; ++c) {
+            const float* wav = wavs[i].data() + c * length;
+            for (Eigen::Index j = 0; j < length; ++j) {
+                write_sample(out[i], format, j * num_channels + c, wav[j]);
+            }
+        }
+    }
+
+    return length * num_channels * sample_size;
+}
+
+void Estimator::reset_stream() {
+    size_t num_channels = this->signal_info.channels;
+    Eigen::Index window_length = static_cast<Eigen::Index>(this->options.stream_frames - 1) * this->hop_length + this->win_length;
+
+    // The input starts with the win_length / 2 zeros that center the first frame
+    this->stream.input.assign(num_channels, std::vector<float>(this->win_length / 2, 0.0f));
+    this->stream.overlap.assign(this->interpreters.size(), std::vector<float>());
+    for (size_t i = 0; i < this->stream.overlap.size(); ++i) {
+        if (this->stem_outputs[i]) {
+            this->stream.overlap[i].assign(num_channels * window_length, 0.0f);
+        }
+    }
+    this->stream.output.assign(this->interpreters.size(), std::vector<float>());
+    this->stream.num_samples = 0;
+    this->stream.num_frames = 0;
+    this->stream.emitted = 0;
+}
+
+void Estimator::process_stream_chunk(int num_frames, bool last) {
+    size_t num_channels = this->signal_info.channels;
+    Eigen::Index window_length = static_cast<Eigen::Index>(this->options.stream_frames - 1) * this->hop_length + this->win_length;
+    Eigen::Index length = static_cast<Eigen::Index>(num_frames - 1) * this->hop_length + this->win_length;
+    int64_t overlap = this->win_length - this->hop_length;
+
+    std::vector<float> input(num_channels * length);
+    for (size_t c = 0; c < num_channels; ++c) {
+        std::copy(this->stream.input[c].begin(), this->stream.input[c].begin() + length, input.begin() + c * length);
+    }
+    std::vector<float*> outputs;
+    for (auto& accumulator : this->stream.overlap) {
+        outputs.push_back(accumulator.empty() ? nullptr : accumulator.data());
+    }
+    separate_chunk(input.data(), length, num_frames, this->options.stream_frames, outputs, window_length);
+
+    // Completed samples are queued without the front padding and, on the
+    // last chunk, without the tail padding, so the output lines up with the
+    // input sample for sample.
+    Eigen::Index done = last ? length : static_cast<Eigen::Index>(num_frames) * this->hop_length;
+    if (complement_last(this->stem_outputs)) {
+        subtract_stems(outputs, window_length, done);
+    }
+    int64_t front = this->win_length / 2;
+    for (size_t i = 0; i < this->stream.overlap.size(); ++i) {
+        if (!outputs[i]) {
+            continue;
+        }
+        float* wav = this->stream.overlap[i].data();
+        for (Eigen::Index j = 0; j < done; ++j) {
+            int64_t index = this->stream.emitted + j - front;
+            if (index < 0 || index >= this->stream.num_samples) {
+                continue;
+            }
+            for (size_t c = 0; c < num_channels; ++c) {
+                this->stream.output[i].push_back(wav[c * window_length + j]);
+            }
+        }
+        for (size_t c = 0; !last && c < num_channels; ++c) {
+            float* channel = wav + c * window_length;
+            std::copy(channel + done, channel + done + overlap, channel);
+            std::fill(channel + overlap, channel + window_length, 0.0f);
+        }
+    }
+    this->stream.emitted += done;
+    this->stream.num_frames += num_frames;
+
+    for (size_t c = 0; !last && c < num_channels; ++c) {
+        std::vector<float>& channel = this->stream.input[c];
+        channel.erase(channel.begin(), channel.begin() + done);
+    }
+}
+
+size_t Estimator::push(const char *in, size_t byte_size) {
+    AudioDataFormat format = this->signal_info.data_format;
+    size_t num_channels = this->signal_info.channels;
+    size_t sample_size = format == PCM_16BIT ? sizeof(short) : sizeof(float);
+    size_t num_samples = byte_size / (sample_size * num_channels);
+
+    for (size_t c = 0; c < num_channels; ++c) {
+        std::vector<float>& channel = this->stream.input[c];
+        channel.reserve(channel.size() + num_samples);
+        for (size_t i = 0; i < num_samples; ++i) {
+            channel.push_back(read_sample(in, format, i * num_channels + c));
+        }
+    }
+    this->stream.num_samples += num_samples;
+
+    // Run a chunk as soon as all of its frames have their input
+    size_t needed = static_cast<size_t>(this->options.stream_frames - 1) * this->hop_length + this->win_length;
+    while (this->stream.input[0].size() >= needed) {
+        process_stream_chunk(this->options.stream_frames, false);
+    }
+
+    return num_samples * num_channels * sample_size;
+}
+
+void Estimator::flush() {
+    std::vector<std::vector<float>> output;
+    if (this->stream.num_samples > 0) {
+        // Frames left to reach the whole-file frame count, the input is zero
+        // padded at the end as in the whole-file STFT.
+        int64_t remaining = 1 + this->stream.num_samples / this->hop_length - this->stream.num_frames;
+        size_t length = static_cast<size_t>(remaining - 1) * this->hop_length + this->win_length;
+        for (auto& channel : this->stream.input) {
+            channel.resize(std::max(channel.size(), length), 0.0f);
+        }
+        while (remaining > 0) {
+            int num_frames = static_cast<int>(std::min<int64_t>(remaining, this->options.stream_frames));
+            process_stream_chunk(num_frames, num_frames == remaining);
+            remaining -= num_frames;
+        }
+    }
+
+    // Start over, keeping what has not been pulled yet
+    output.swap(this->stream.output);
+    reset_stream();
+    output.swap(this->stream.output);
+}
+
+size_t Estimator::pull(char *out_1, char *out_2, size_t byte_size) {
+    std::vector<char*> outputs = {out_1, out_2};
+    return pull(outputs, byte_size);
+}
+
+size_t Estimator::pull(const std::vector<char*>& out, size_t byte_size) {
+    check_outputs(out);
+    AudioDataFormat format = this->signal_info.data_format;
+    size_t num_channels = this->signal_info.channels;
+    size_t sample_size = format == PCM_16BIT ? sizeof(short) : sizeof(float);
+    size_t count = std::min(byte_size / (sample_size * num_channels) * num_channels, this->stream.output[this->first_output].size());
+
+    for (size_t i = 0; i < this->stream.output.size(); ++i) {
+        std::vector<float>& wav = this->stream.output[i];
+        if (wav.empty()) {
+            continue;
+        }
+        for (size_t j = 0; out[i] && j < count; ++j) {
+            write_sample(out[i], format, j, wav[j]);
+        }
+        wav.erase(wav.begin(), wav.begin() + count);
+    }
+
+    return count * sample_size;
+}
+
+size_t Estimator::available() const {
+    size_t sample_size = this->signal_info.data_format == PCM_16BIT ? sizeof(short) : sizeof(float);
+    return this->stream.output[this->first_output].size() * sample_size;
+}
+
+const std::vector<std::string>& Estimator::stems() const {
+    return this->stem_names;
+}
+
+size_t Estimator::gated_segments() const {
+    return this->num_gated;
+}
+
+size_t Estimator::skipped_segments() const {
+    return this->num_skipped;
+}
+
+size_t Estimator::latency() const {
+    // A sample just past the completed part of a chunk waits for the whole
+    // next chunk: stream_frames hops plus the frame overlap.
+    return static_cast<size_t>(this->options.stream_frames) * this->hop_length + this->win_length - this->hop_length;
+}
+
+void Estimator::warm_up(const std::vector<int>& batch_sizes) {
+    std::vector<std::pair<int, int>> shapes;
+    for (int B : batch_sizes) {
+        int max_batch = this->options.max_batch;
+        shapes.push_back(std::make_pair(batch_bucket(max_batch > 0 ? std::min(B, max_batch) : B), this->T));
+    }
+    shapes.push_back(std::make_pair(1, this->options.stream_frames));
+
+    for (const auto& shape : shapes) {
+        Eigen::Index input_size = shape.first * model_segment_size(shape.second);
+        run_models(shape.first, shape.second, [input_size](float* input) {
+            std::fill(input, input + input_size, 0.0f);
+        }, [](const std::vector<const float*>&) {});
+    }
 }
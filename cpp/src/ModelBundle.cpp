@@ -0,0 +1,161 @@
+#include <stdexcept>
+#include <cstring>
+#include <fstream>
+#include "ModelBundle.hpp"
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static const char BUNDLE_MAGIC[4] = {'S', 'M', 'N', 'B'};
+static const uint32_t BUNDLE_VERSION = 1;
+static const size_t HEADER_SIZE = 160;
+static const size_t STEM_ENTRY_SIZE = 48;
+static const size_t NAME_SIZE = 64;
+static const size_t STEM_NAME_SIZE = 32;
+static const uint32_t MAX_STEMS = 16;
+
+// Fields are little-endian and unaligned in the file
+static uint32_t read_u32(const unsigned char* p) {
+    return static_cast<uint32_t>(p[0]) | static_cast<uint32_t>(p[1]) << 8 | static_cast<uint32_t>(p[2]) << 16 | static_cast<uint32_t>(p[3]) << 24;
+}
+
+static uint64_t read_u64(const unsigned char* p) {
+    return static_cast<uint64_t>(read_u32(p)) | static_cast<uint64_t>(read_u32(p + 4)) << 32;
+}
+
+// CRC-32 as computed by zlib.crc32, which the packing script uses
+static uint32_t bundle_crc32(const unsigned char* data, size_t size) {
+    static uint32_t table[256];
+    static bool table_ready = false;
+    if (!table_ready) {
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; ++k) {
+                c = c & 1 ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            }
+            table[i] = c;
+        }
+        table_ready = true;
+    }
+
+    uint32_t crc = 0xFFFFFFFFu;
+    for (size_t i = 0; i < size; ++i) {
+        crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return crc ^ 0xFFFFFFFFu;
+}
+
+// A fixed-size name field, NUL-terminated and not empty
+static std::string read_name(const unsigned char* p, size_t size, const char* what) {
+    const char* name = reinterpret_cast<const char*>(p);
+    size_t length = strnlen(name, size);
+    if (length == 0 || length == size) {
+        throw std::runtime_error(std::string("Invalid ") + what + " in model bundle.");
+    }
+    return std::string(name, length);
+}
+
+ModelBundle::ModelBundle() : F(1024), T(512), win_length(4096), hop_length(1024),
+    input_name("onnx::Pad_0"), output_name("379"), mapping(nullptr), mapping_size(0) {
+}
+
+ModelBundle::ModelBundle(const std::string& bundle_path) : ModelBundle() {
+#ifdef _WIN32
+    std::ifstream file(bundle_path.c_str(), std::ios::binary | std::ios::ate);
+    if (!file.is_open()) {
+        throw std::runtime_error("Failed to open model bundle.");
+    }
+    this->mapping_size = static_cast<size_t>(file.tellg());
+    this->mapping = new char[this->mapping_size];
+    file.seekg(0, std::ios::beg);
+    if (!file.read(static_cast<char*>(this->mapping), this->mapping_size)) {
+        throw std::runtime_error("Failed to read model bundle.");
+    }
+#else
+    int fd = open(bundle_path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("Failed to open model bundle.");
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+        close(fd);
+        throw std::runtime_error("Failed to open model bundle.");
+    }
+    void* data = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        throw std::runtime_error("Failed to map model bundle.");
+    }
+    madvise(data, static_cast<size_t>(st.st_size), MADV_SEQUENTIAL);
+    this->mapping = data;
+    this->mapping_size = static_cast<size_t>(st.st_size);
+#endif
+
+    // One pass over the header, the stem table and the data. The destructor
+    // runs for the delegated object, so a throw here releases the mapping.
+    const unsigned char* bytes = static_cast<const unsigned char*>(this->mapping);
+    size_t size = this->mapping_size;
+    if (size < HEADER_SIZE || memcmp(bytes, BUNDLE_MAGIC, sizeof(BUNDLE_MAGIC)) != 0) {
+        throw std::runtime_error("Not a model bundle.");
+    }
+    if (read_u32(bytes + 4) != BUNDLE_VERSION) {
+        throw std::runtime_error("Unsupported model bundle version.");
+    }
+    uint32_t num_stems = read_u32(bytes + 8);
+    if (num_stems == 0 || num_stems > MAX_STEMS || size < HEADER_SIZE + num_stems * STEM_ENTRY_SIZE) {
+        throw std::runtime_error("Invalid stem count in model bundle.");
+    }
+
+    this->F = static_cast<int32_t>(read_u32(bytes + 12));
+    this->T = static_cast<int32_t>(read_u32(bytes + 16));
+    this->win_length = static_cast<int32_t>(read_u32(bytes + 20));
+    this->hop_length = static_cast<int32_t>(read_u32(bytes + 24));
+    bool power_of_two = this->win_length >= 4 && (this->win_length & (this->win_length - 1)) == 0;
+    if (!power_of_two || this->hop_length <= 0 || this->hop_length > this->win_length
+        || this->F <= 0 || this->F > this->win_length / 2 + 1 || this->T <= 0 || this->T % 64 != 0) {
+        throw std::runtime_error("Invalid STFT parameters in model bundle.");
+    }
+    this->input_name = read_name(bytes + 28, NAME_SIZE, "input tensor name");
+    this->output_name = read_name(bytes + 28 + NAME_SIZE, NAME_SIZE, "output tensor name");
+
+    size_t data_begin = HEADER_SIZE + num_stems * STEM_ENTRY_SIZE;
+    for (uint32_t i = 0; i < num_stems; ++i) {
+        const unsigned char* entry = bytes + HEADER_SIZE + i * STEM_ENTRY_SIZE;
+        ModelSource stem;
+        stem.name = read_name(entry, STEM_NAME_SIZE, "stem name");
+        uint64_t offset = read_u64(entry + STEM_NAME_SIZE);
+        uint64_t length = read_u64(entry + STEM_NAME_SIZE + 8);
+        if (offset < data_begin || offset > size || length == 0 || length > size - offset) {
+            throw std::runtime_error("Invalid model range in model bundle.");
+        }
+        stem.path = bundle_path;
+        stem.data = bytes + offset;
+        stem.size = static_cast<size_t>(length);
+        this->stems.push_back(stem);
+    }
+
+    if (bundle_crc32(bytes + data_begin, size - data_begin) != read_u32(bytes + 156)) {
+        throw std::runtime_error("Model bundle checksum mismatch.");
+    }
+}
+
+ModelBundle::ModelBundle(ModelBundle&& other) : F(other.F), T(other.T), win_length(other.win_length), hop_length(other.hop_length),
+    input_name(other.input_name), output_name(other.output_name), stems(other.stems), mapping(other.mapping), mapping_size(other.mapping_size) {
+    other.mapping = nullptr;
+    other.mapping_size = 0;
+    other.stems.clear();
+}
+
+ModelBundle::~ModelBundle() {
+    if (!this->mapping) {
+        return;
+    }
+#ifdef _WIN32
+    delete[] static_cast<char*>(this->mapping);
+#else
+    munmap(this->mapping, this->mapping_size);
+#endif
+}
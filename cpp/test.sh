@@ -10,4 +10,7 @@ cmake -DCMAKE_BUILD_TYPE=Debug -DENABLE_TESTING=1 ../test/
 make -j8
 
 git_root=$(git rev-parse --show-toplevel)
-./test-audio-separation $git_root/audio/coc_f32.pcm $git_root/models/vocal.mnn $git_root/models/accompaniment.mnn
\ No newline at end of file
+./test-audio-separation $git_root/audio/coc_f32.pcm $git_root/models/vocal.mnn $git_root/models/accompaniment.mnn
+
+# The pipelined chunked path must stay bit-exact with the sequential one
+./bench-audio-separation pipeline $git_root/audio/coc_f32.pcm $git_root/models/vocal.mnn $git_root/models/accompaniment.mnn
@@ -0,0 +1,43 @@
+#ifndef PCM_FILE_HPP
+#define PCM_FILE_HPP
+
+#include <iostream>
+#include <fstream>
+
+// Raw PCM files shared by the test and benchmark programs
+
+inline bool WriteByteArrayToPcm(const char* filename, const char* data, size_t size) {
+    std::ofstream file(filename, std::ios::binary | std::ios::ate);
+    if (!file.is_open()) {
+        std::cerr << "Unable to open file: " << filename << std::endl;
+        return false;
+    }
+
+    file.write(data, size);
+    return true;
+}
+
+inline char* ReadPcmToByteArray(const char* filename, size_t& size) {
+    std::ifstream file(filename, std::ios::binary | std::ios::ate);
+    if (!file.is_open()) {
+        std::cerr << "Unable to open file: " << filename << std::endl;
+        return nullptr;
+    }
+
+    size = file.tellg();
+    file.seekg(0, std::ios::beg);
+
+    char* data = new char[size];
+
+    if (!file.read(data, size)) {
+        std::cerr << "Error reading file: " << filename << std::endl;
+        delete[] data;
+        file.close();
+        return nullptr;
+    }
+
+    file.close();
+    return data;
+}
+
+#endif // PCM_FILE_HPP
@@ -0,0 +1,1056 @@
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <chrono>
+#include <cstring>
+#include <thread>
+#include <cmath>
+#include <limits>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <mutex>
+#include "Estimator.hpp"
+#include "BatchScheduler.hpp"
+#include "PcmFile.hpp"
+
+// Define ANSI color codes
+const char* red = "\033[31m";
+const char* yellow = "\033[33m";
+const char* reset = "\033[0m";
+
+using namespace std;
+
+const int SAMPLE_RATE = 44100;
+const int CHANNELS = 2;
+const enum AudioDataFormat PCM_FORMAT = PCM_FLOAT32;
+
+static double audio_seconds(size_t byte_size) {
+    return static_cast<double>(byte_size) / (SAMPLE_RATE * CHANNELS * (PCM_FORMAT == PCM_FLOAT32 ? sizeof(float) : sizeof(short)));
+}
+
+// Estimator for the two models or a bundle; null, with the error printed,
+// when construction fails.
+static unique_ptr<Estimator> make_estimator(const string& vocal_model_path, const string& accompaniment_model_path, const EstimatorOptions& options) {
+    SignalInfo in_signal = {SAMPLE_RATE, CHANNELS, PCM_FORMAT};
+    try {
+        return unique_ptr<Estimator>(new Estimator(vocal_model_path, accompaniment_model_path, in_signal, options));
+    } catch (const runtime_error& e) {
+        cerr << red << "Failed to initialize Estimator: " << e.what() << reset << endl;
+        return nullptr;
+    }
+}
+
+static unique_ptr<Estimator> make_estimator(const string& bundle_path, const EstimatorOptions& options) {
+    SignalInfo in_signal = {SAMPLE_RATE, CHANNELS, PCM_FORMAT};
+    try {
+        return unique_ptr<Estimator>(new Estimator(bundle_path, in_signal, options));
+    } catch (const runtime_error& e) {
+        cerr << red << "Failed to initialize Estimator: " << e.what() << reset << endl;
+        return nullptr;
+    }
+}
+
+// One buffer per stem, large enough for the separate() output of byte_size
+// input bytes, which adds up to win_length samples of padding.
+static vector<char*> alloc_outputs(vector<vector<char>>& buffers, size_t num_stems, size_t byte_size) {
+    buffers.assign(num_stems, vector<char>(byte_size + 2 * 4096 * sizeof(float) * CHANNELS));
+    vector<char*> outputs;
+    for (auto& buffer : buffers) {
+        outputs.push_back(buffer.data());
+    }
+    return outputs;
+}
+
+// Largest absolute difference between the samples of two outputs, b read
+// from offset samples on.
+static float max_abs_diff(const char* a, const char* b, size_t num_bytes, size_t offset = 0) {
+    const float* x = reinterpret_cast<const float*>(a);
+    const float* y = reinterpret_cast<const float*>(b) + offset;
+    float max_diff = 0.0f;
+    for (size_t j = 0; j < num_bytes / sizeof(float); ++j) {
+        max_diff = max(max_diff, fabs(x[j] - y[j]));
+    }
+    return max_diff;
+}
+
+// Prints how every stem of two runs compares, in the one format all modes
+// share. False when the output sizes differ or a sample differs by more than
+// tolerance; paths claimed to be bit-exact keep the default of 0.
+static bool report_diff(const vector<char*>& a, size_t a_bytes, const vector<char*>& b, size_t b_bytes, size_t offset = 0, float tolerance = 0.0f) {
+    if (a_bytes != b_bytes) {
+        cout << red << "output size differs: " << a_bytes << " vs " << b_bytes << " bytes" << reset << endl;
+        return false;
+    }
+    float max_diff = 0.0f;
+    for (size_t i = 0; i < a.size(); ++i) {
+        max_diff = max(max_diff, max_abs_diff(a[i], b[i], a_bytes, offset));
+    }
+    ios::fmtflags flags = cout.flags();
+    streamsize precision = cout.precision();
+    cout << "max abs diff " << scientific << setprecision(2) << max_diff << endl;
+    cout.flags(flags);
+    cout.precision(precision);
+    if (max_diff > tolerance) {
+        cout << red << "outputs differ by more than " << tolerance << reset << endl;
+        return false;
+    }
+    return true;
+}
+
+// Wall time of one addFrames + separate pass, in seconds.
+static double time_separate(Estimator& es, char* in, size_t byte_size) {
+    auto start_time = chrono::high_resolution_clock::now();
+    vector<vector<char>> buffers;
+    vector<char*> outputs = alloc_outputs(buffers, 2, es.addFrames(in, byte_size));
+    es.separate(outputs);
+    auto end_time = chrono::high_resolution_clock::now();
+    return chrono::duration<double>(end_time - start_time).count();
+}
+
+// CPU backend, 1 .. max_threads threads per session, sequential and concurrent sessions.
+static int bench_threads(char* in, size_t byte_size, const string& vocal_model_path, const string& accompaniment_model_path, int max_threads) {
+    double duration = audio_seconds(byte_size);
+    double baseline = 0.0;
+
+    cout << yellow << "CPU scaling on " << duration << " s of audio" << reset << endl;
+    cout << setw(8) << "threads" << setw(12) << "mode" << setw(12) << "time (s)" << setw(10) << "speedup" << setw(8) << "RTF" << endl;
+    for (int threads = 1; threads <= max_threads; threads = threads < 2 ? threads + 1 : threads * 2) {
+        for (int concurrent = 0; concurrent < 2; ++concurrent) {
+            EstimatorOptions options;
+            options.forward_types.push_back(MNN_FORWARD_CPU);
+            options.num_threads = threads;
+            options.concurrent_sessions = concurrent != 0;
+
+            unique_ptr<Estimator> es = make_estimator(vocal_model_path, accompaniment_model_path, options);
+            if (!es) {
+                return -1;
+            }
+            time_separate(*es, in, byte_size);  // warm-up
+            double seconds = time_separate(*es, in, byte_size);
+            es.reset();
+
+            if (baseline == 0.0) {
+                baseline = seconds;
+            }
+            cout << setw(8) << threads << setw(12) << (concurrent ? "concurrent" : "sequential") << fixed << setprecision(3)
+                 << setw(12) << seconds << setw(9) << baseline / seconds << "x" << setw(8) << setprecision(1) << duration / seconds << endl;
+        }
+    }
+
+    return 0;
+}
+
+static double peak_rss_mb() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss / 1024.0;
+}
+
+// Chunked separate(in, ...) against addFrames + separate(). The chunked pass
+// runs first, since peak RSS only ever grows.
+static int bench_chunked(char* in, size_t byte_size, const string& vocal_model_path, const string& accompaniment_model_path, int chunk_segments) {
+    EstimatorOptions options;
+    options.chunk_segments = chunk_segments;
+    unique_ptr<Estimator> es = make_estimator(vocal_model_path, accompaniment_model_path, options);
+    if (!es) {
+        return -1;
+    }
+
+    vector<vector<char>> chunked_buffers, whole_buffers;
+    vector<char*> chunked = alloc_outputs(chunked_buffers, 2, byte_size);
+    vector<char*> whole = alloc_outputs(whole_buffers, 2, byte_size);
+    double rss_before = peak_rss_mb();
+
+    auto start_time = chrono::high_resolution_clock::now();
+    size_t chunked_size = es->separate(in, byte_size, chunked);
+    auto end_time = chrono::high_resolution_clock::now();
+    double chunked_seconds = chrono::duration<double>(end_time - start_time).count();
+    double chunked_rss = peak_rss_mb();
+
+    start_time = chrono::high_resolution_clock::now();
+    es->addFrames(in, byte_size);
+    size_t whole_size = es->separate(whole);
+    end_time = chrono::high_resolution_clock::now();
+    double whole_seconds = chrono::duration<double>(end_time - start_time).count();
+    double whole_rss = peak_rss_mb();
+    es.reset();
+
+    cout << yellow << "Chunks of " << chunk_segments << " segment(s) on " << audio_seconds(byte_size) << " s of audio" << reset << endl;
+    cout << fixed << setprecision(3);
+    cout << "chunked: " << chunked_seconds << " s, peak RSS growth " << setprecision(1) << chunked_rss - rss_before << " MB" << endl;
+    cout << setprecision(3) << "whole:   " << whole_seconds << " s, peak RSS growth " << setprecision(1) << whole_rss - rss_before << " MB" << endl;
+    return report_diff(chunked, chunked_size, whole, whole_size) ? 0 : -1;
+}
+
+// Streaming push/pull in blocks of block_ms against addFrames + separate(),
+// whose output carries win_length / 2 samples of front padding.
+static int bench_stream(char* in, size_t byte_size, const string& vocal_model_path, const string& accompaniment_model_path, int stream_frames, int block_ms) {
+    EstimatorOptions options;
+    options.stream_frames = stream_frames;
+    unique_ptr<Estimator> es = make_estimator(vocal_model_path, accompaniment_model_path, options);
+    if (!es) {
+        return -1;
+    }
+
+    const size_t frame_size = sizeof(float) * CHANNELS;
+    size_t block_size = static_cast<size_t>(SAMPLE_RATE) * block_ms / 1000 * frame_size;
+    vector<vector<char>> stream_buffers, whole_buffers;
+    vector<char*> stream = alloc_outputs(stream_buffers, 2, byte_size);
+    size_t pulled = 0;
+    double worst_push_ms = 0.0;
+
+    auto start_time = chrono::high_resolution_clock::now();
+    for (size_t offset = 0; offset < byte_size; offset += block_size) {
+        auto push_start = chrono::high_resolution_clock::now();
+        es->push(in + offset, min(block_size, byte_size - offset));
+        auto push_end = chrono::high_resolution_clock::now();
+        worst_push_ms = max(worst_push_ms, chrono::duration<double, milli>(push_end - push_start).count());
+        pulled += es->pull(stream[0] + pulled, stream[1] + pulled, byte_size - pulled);
+    }
+    es->flush();
+    pulled += es->pull(stream[0] + pulled, stream[1] + pulled, byte_size - pulled);
+    auto end_time = chrono::high_resolution_clock::now();
+    double stream_seconds = chrono::duration<double>(end_time - start_time).count();
+
+    vector<char*> whole = alloc_outputs(whole_buffers, 2, es->addFrames(in, byte_size));
+    es->separate(whole);
+    size_t latency = es->latency();
+    es.reset();
+
+    cout << yellow << "Streaming " << stream_frames << " frames per chunk, " << block_ms << " ms blocks" << reset << endl;
+    cout << fixed << setprecision(3);
+    cout << "latency " << latency << " samples (" << static_cast<double>(latency) / SAMPLE_RATE << " s), worst push " << worst_push_ms << " ms, total " << stream_seconds << " s" << endl;
+    cout << "pulled " << pulled << " of " << byte_size << " bytes, against whole-file: ";
+    bool match = report_diff(stream, pulled, whole, pulled, 2048 * CHANNELS);
+    return pulled == byte_size && match ? 0 : -1;
+}
+
+// Tracks of alternating lengths, so that every call changes B, with one
+// cached session per model (a resize on every call) and with the cache.
+static int bench_cache(char* in, size_t byte_size, const string& vocal_model_path, const string& accompaniment_model_path, int rounds) {
+    const size_t frame_size = sizeof(float) * CHANNELS;
+    const size_t segment_bytes = 512 * 1024 * frame_size;
+    vector<size_t> lengths;
+    for (size_t length = segment_bytes / 2; length <= byte_size && lengths.size() < 3; length += segment_bytes) {
+        lengths.push_back(length);
+    }
+    if (lengths.empty()) {
+        cerr << red << "Input is too short" << reset << endl;
+        return -1;
+    }
+
+    vector<vector<char>> buffers;
+    vector<char*> outputs = alloc_outputs(buffers, 2, byte_size);
+    cout << yellow << rounds << " rounds over " << lengths.size() << " track lengths" << reset << endl;
+    for (int cache_size = 1; cache_size <= 4; cache_size += 3) {
+        EstimatorOptions options;
+        options.session_cache_size = cache_size;
+        unique_ptr<Estimator> es = make_estimator(vocal_model_path, accompaniment_model_path, options);
+        if (!es) {
+            return -1;
+        }
+
+        auto start_time = chrono::high_resolution_clock::now();
+        vector<int> batch_sizes;
+        for (size_t length : lengths) {
+            batch_sizes.push_back(static_cast<int>((1 + length / frame_size / 1024 + 511) / 512));
+        }
+        if (cache_size > 1) {
+            es->warm_up(batch_sizes);
+        }
+        auto warm_time = chrono::high_resolution_clock::now();
+        for (int round = 0; round < rounds; ++round) {
+            for (size_t length : lengths) {
+                es->separate(in, length, outputs);
+            }
+        }
+        auto end_time = chrono::high_resolution_clock::now();
+        es.reset();
+
+        double warm_ms = chrono::duration<double, milli>(warm_time - start_time).count();
+        double call_ms = chrono::duration<double, milli>(end_time - warm_time).count() / (rounds * lengths.size());
+        cout << fixed << setprecision(1) << "cache size " << cache_size << ": warm-up " << warm_ms << " ms, " << call_ms << " ms per call" << endl;
+    }
+
+    return 0;
+}
+
+// NCHW model input/output against the packed NC4HW4 layout
+static int bench_layout(char* in, size_t byte_size, const string& vocal_model_path, const string& accompaniment_model_path, int rounds) {
+    vector<vector<char>> buffers[2];
+    vector<char*> outputs[2];
+    size_t sizes[2] = {0, 0};
+
+    cout << yellow << "Model layout over " << rounds << " rounds on " << audio_seconds(byte_size) << " s of audio" << reset << endl;
+    for (int packed = 0; packed < 2; ++packed) {
+        EstimatorOptions options;
+        options.packed_layout = packed != 0;
+        unique_ptr<Estimator> es = make_estimator(vocal_model_path, accompaniment_model_path, options);
+        if (!es) {
+            return -1;
+        }
+
+        outputs[packed] = alloc_outputs(buffers[packed], 2, byte_size);
+        sizes[packed] = es->separate(in, byte_size, outputs[packed]);  // warm-up
+        auto start_time = chrono::high_resolution_clock::now();
+        for (int round = 0; round < rounds; ++round) {
+            es->separate(in, byte_size, outputs[packed]);
+        }
+        auto end_time = chrono::high_resolution_clock::now();
+        es.reset();
+
+        double call_ms = chrono::duration<double, milli>(end_time - start_time).count() / rounds;
+        cout << fixed << setprecision(1) << (packed ? "NC4HW4: " : "NCHW:   ") << call_ms << " ms per call" << endl;
+    }
+
+    return report_diff(outputs[0], sizes[0], outputs[1], sizes[1]) ? 0 : -1;
+}
+
+// Runs func in a forked child, so that its peak RSS is measured on its own.
+template <typename Func>
+static int run_in_child(Func func) {
+    cout.flush();
+    pid_t pid = fork();
+    if (pid == 0) {
+        int result = func();
+        cout.flush();
+        _exit(result == 0 ? 0 : 1);
+    }
+    int status = 0;
+    waitpid(pid, &status, 0);
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0 ? 0 : -1;
+}
+
+// Peak RSS of one separate() with private runtimes and with a shared runtime
+static int bench_runtime(char* in, size_t byte_size, const string& vocal_model_path, const string& accompaniment_model_path) {
+    cout << yellow << "Runtime sharing on " << audio_seconds(byte_size) << " s of audio" << reset << endl;
+    int result = 0;
+    for (int shared = 0; shared < 2; ++shared) {
+        result |= run_in_child([&]() {
+            EstimatorOptions options;
+            options.shared_runtime = shared != 0;
+            double rss_before = peak_rss_mb();
+            unique_ptr<Estimator> es = make_estimator(vocal_model_path, accompaniment_model_path, options);
+            if (!es) {
+                return -1;
+            }
+            double seconds = time_separate(*es, in, byte_size);
+            double rss_after = peak_rss_mb();
+            es.reset();
+            cout << fixed << setprecision(1) << (shared ? "shared runtime:   " : "private runtimes: ") << "peak RSS " << rss_after
+                 << " MB (+" << rss_after - rss_before << " MB), " << setprecision(3) << seconds << " s" << endl;
+            return 0;
+        });
+    }
+    return result;
+}
+
+// Peak RSS and time of one whole-file separate() with all segments in one
+// batch and in micro-batches of max_batch, each in a fresh process.
+static int bench_batch(char* in, size_t byte_size, const string& vocal_model_path, const string& accompaniment_model_path, int max_batch) {
+    cout << yellow << "Micro-batches of " << max_batch << " segment(s) on " << audio_seconds(byte_size) << " s of audio" << reset << endl;
+    int result = 0;
+    for (int batched = 0; batched < 2; ++batched) {
+        result |= run_in_child([&]() {
+            EstimatorOptions options;
+            options.forward_types.push_back(MNN_FORWARD_CPU);
+            options.max_batch = batched ? max_batch : 0;
+            double rss_before = peak_rss_mb();
+            unique_ptr<Estimator> es = make_estimator(vocal_model_path, accompaniment_model_path, options);
+            if (!es) {
+                return -1;
+            }
+            double seconds = time_separate(*es, in, byte_size);
+            double rss_after = peak_rss_mb();
+            es.reset();
+            cout << fixed << setprecision(1) << (batched ? "micro-batched: " : "one batch:     ") << "peak RSS " << rss_after
+                 << " MB (+" << rss_after - rss_before << " MB), " << setprecision(3) << seconds << " s" << endl;
+            return 0;
+        });
+    }
+    return result;
+}
+
+// Construction and first separate() with no tuning cache, with the cache the
+// first run wrote and with a corrupted cache, each in a fresh process.
+static int bench_tuning(char* in, size_t byte_size, const string& vocal_model_path, const string& accompaniment_model_path, const string& cache_prefix) {
+    EstimatorOptions options;
+    options.cache_files.push_back(cache_prefix + ".vocal.cache");
+    options.cache_files.push_back(cache_prefix + ".accompaniment.cache");
+    for (const string& cache_file : options.cache_files) {
+        remove(cache_file.c_str());
+    }
+
+    const char* runs[] = {"cold", "warm", "corrupt"};
+    cout << yellow << "Tuning cache at " << cache_prefix << ".*.cache" << reset << endl;
+    int result = 0;
+    for (int run = 0; run < 3; ++run) {
+        if (run == 2) {
+            for (const string& cache_file : options.cache_files) {
+                ofstream file(cache_file.c_str(), ios::binary | ios::trunc);
+                file << "not an MNN cache";
+            }
+        }
+        result |= run_in_child([&]() {
+            auto start_time = chrono::high_resolution_clock::now();
+            unique_ptr<Estimator> es = make_estimator(vocal_model_path, accompaniment_model_path, options);
+            if (!es) {
+                return -1;
+            }
+            auto end_time = chrono::high_resolution_clock::now();
+            double construct_ms = chrono::duration<double, milli>(end_time - start_time).count();
+            double first_ms = time_separate(*es, in, byte_size) * 1000.0;
+            es.reset();
+            cout << fixed << setprecision(1) << setw(8) << runs[run] << ": construction " << construct_ms << " ms, first separate " << first_ms << " ms" << endl;
+            return 0;
+        });
+    }
+    return result;
+}
+
+// Rss and Pss of this process in MB from /proc/self/smaps_rollup, Pss splits
+// shared pages between the processes mapping them.
+static bool memory_usage_mb(double& rss, double& pss) {
+    ifstream file("/proc/self/smaps_rollup");
+    string line;
+    rss = pss = -1.0;
+    while (getline(file, line)) {
+        if (line.compare(0, 4, "Rss:") == 0) {
+            rss = atof(line.c_str() + 4) / 1024.0;
+        } else if (line.compare(0, 4, "Pss:") == 0) {
+            pss = atof(line.c_str() + 4) / 1024.0;
+        }
+    }
+    return rss >= 0.0 && pss >= 0.0;
+}
+
+struct WorkerStats {
+    double construct_ms;
+    double rss;
+    double pss;
+};
+
+// num_workers processes construct an Estimator at the same time, with
+// createFromFile and with memory-mapped models. The workers stay alive until
+// all of them reported, so shared pages are counted once across them.
+static int bench_processes(const string& vocal_model_path, const string& accompaniment_model_path, int num_workers) {
+    cout << yellow << num_workers << " worker processes" << reset << endl;
+    for (int mapped = 0; mapped < 2; ++mapped) {
+        int results[2], release[2];
+        if (pipe(results) != 0 || pipe(release) != 0) {
+            cerr << red << "pipe failed" << reset << endl;
+            return -1;
+        }
+        cout.flush();
+        vector<pid_t> workers;
+        for (int i = 0; i < num_workers; ++i) {
+            pid_t pid = fork();
+            if (pid == 0) {
+                close(results[0]);
+                close(release[1]);
+                EstimatorOptions options;
+                options.mmap_models = mapped != 0;
+                WorkerStats stats = {-1.0, -1.0, -1.0};
+                auto start_time = chrono::high_resolution_clock::now();
+                unique_ptr<Estimator> es = make_estimator(vocal_model_path, accompaniment_model_path, options);
+                auto end_time = chrono::high_resolution_clock::now();
+                if (es) {
+                    stats.construct_ms = chrono::duration<double, milli>(end_time - start_time).count();
+                    memory_usage_mb(stats.rss, stats.pss);
+                }
+                ssize_t written = write(results[1], &stats, sizeof(stats));
+                char byte;
+                ssize_t released = read(release[0], &byte, 1);
+                (void)written;
+                (void)released;
+                es.reset();
+                _exit(0);
+            }
+            workers.push_back(pid);
+        }
+        close(results[1]);
+        close(release[0]);
+
+        double total_ms = 0.0, worst_ms = 0.0, total_rss = 0.0, total_pss = 0.0;
+        int failed = 0;
+        for (int i = 0; i < num_workers; ++i) {
+            WorkerStats stats;
+            if (read(results[0], &stats, sizeof(stats)) != static_cast<ssize_t>(sizeof(stats)) || stats.construct_ms < 0.0) {
+                ++failed;
+                continue;
+            }
+            total_ms += stats.construct_ms;
+            worst_ms = max(worst_ms, stats.construct_ms);
+            total_rss += stats.rss;
+            total_pss += stats.pss;
+        }
+        close(release[1]);
+        close(results[0]);
+        for (pid_t pid : workers) {
+            waitpid(pid, nullptr, 0);
+        }
+        if (failed > 0) {
+            cerr << red << failed << " worker(s) failed" << reset << endl;
+            return -1;
+        }
+
+        cout << fixed << setprecision(1) << (mapped ? "mmap:            " : "createFromFile:  ") << "construction avg " << total_ms / num_workers << " ms, worst " << worst_ms
+             << " ms, RSS avg " << total_rss / num_workers << " MB, PSS total " << total_pss << " MB" << endl;
+    }
+    return 0;
+}
+
+// Per-stem work of a bundle with any number of stems, run on the calling
+// thread and on stem pools of 2 .. max_workers threads.
+static int bench_stems(char* in, size_t byte_size, const string& bundle_path, int max_workers) {
+    double duration = audio_seconds(byte_size);
+    double baseline = 0.0;
+
+    for (int workers = 1; workers <= max_workers; ++workers) {
+        EstimatorOptions options;
+        options.forward_types.push_back(MNN_FORWARD_CPU);
+        options.concurrent_sessions = workers > 1;
+        options.stem_workers = workers;
+
+        unique_ptr<Estimator> es = make_estimator(bundle_path, options);
+        if (!es) {
+            return -1;
+        }
+        size_t num_stems = es->stems().size();
+        if (workers == 1) {
+            cout << yellow << num_stems << " stems on " << duration << " s of audio" << reset << endl;
+            cout << setw(8) << "workers" << setw(12) << "time (s)" << setw(10) << "speedup" << setw(8) << "RTF" << endl;
+        }
+
+        size_t num_bytes = es->addFrames(in, byte_size);
+        vector<vector<char>> buffers;
+        vector<char*> outputs = alloc_outputs(buffers, num_stems, num_bytes);
+        es->separate(outputs);  // warm-up
+        auto start_time = chrono::high_resolution_clock::now();
+        es->separate(outputs);
+        double seconds = chrono::duration<double>(chrono::high_resolution_clock::now() - start_time).count();
+        es.reset();
+
+        if (baseline == 0.0) {
+            baseline = seconds;
+        }
+        cout << setw(8) << workers << fixed << setprecision(3) << setw(12) << seconds << setw(9) << baseline / seconds << "x"
+             << setw(8) << setprecision(1) << duration / seconds << endl;
+        if (static_cast<size_t>(workers) >= num_stems) {
+            break;
+        }
+    }
+    return 0;
+}
+
+// Every stem against a single one through output_stems; the models run in
+// both cases, the difference is the masking, iSTFT and PCM conversion.
+static int bench_subset(char* in, size_t byte_size, const string& bundle_path, const string& stem, int rounds) {
+    double duration = audio_seconds(byte_size);
+    double baseline = 0.0;
+
+    cout << yellow << "Stem subset on " << duration << " s of audio, best of " << rounds << reset << endl;
+    for (int subset = 0; subset < 2; ++subset) {
+        EstimatorOptions options;
+        options.forward_types.push_back(MNN_FORWARD_CPU);
+        if (subset) {
+            options.output_stems.push_back(stem);
+        }
+
+        unique_ptr<Estimator> es = make_estimator(bundle_path, options);
+        if (!es) {
+            return -1;
+        }
+        size_t num_bytes = es->addFrames(in, byte_size);
+        vector<vector<char>> buffers;
+        vector<char*> outputs = alloc_outputs(buffers, es->stems().size(), num_bytes);
+        es->separate(outputs);  // warm-up
+        double best = 0.0;
+        for (int round = 0; round < rounds; ++round) {
+            auto start_time = chrono::high_resolution_clock::now();
+            es->separate(outputs);
+            double seconds = chrono::duration<double>(chrono::high_resolution_clock::now() - start_time).count();
+            best = round == 0 ? seconds : min(best, seconds);
+        }
+        es.reset();
+
+        if (baseline == 0.0) {
+            baseline = best;
+        }
+        cout << (subset ? stem + " only: " : "all stems: ") << fixed << setprecision(3) << best << " s, " << baseline / best << "x" << endl;
+    }
+    return 0;
+}
+
+// iSTFT of the input's bins at or above num_bins, interleaved and framed as
+// the separate() output: the part of the mixture the models never see.
+static vector<float> high_band(const char* in, size_t byte_size, int win_length, int hop_length, int num_bins) {
+    size_t num_samples = byte_size / (CHANNELS * sizeof(float));
+    int num_frames = 1 + static_cast<int>(num_samples) / hop_length;
+    size_t length = win_length + static_cast<size_t>(num_frames - 1) * hop_length;
+    StftEngine engine(win_length, hop_length, periodicHanningWindow(win_length));
+    vector<float> band(length * CHANNELS, 0.0f);
+    vector<float> channel(num_samples);
+    vector<complex<float>> spectrum(engine.num_bins());
+    vector<float> frame(win_length);
+    for (int c = 0; c < CHANNELS; ++c) {
+        for (size_t i = 0; i < num_samples; ++i) {
+            channel[i] = reinterpret_cast<const float*>(in)[i * CHANNELS + c];
+        }
+        for (int t = 0; t < num_frames; ++t) {
+            engine.stft_frame(channel.data(), static_cast<int>(num_samples), t, spectrum.data(), engine.num_bins());
+            fill(spectrum.begin(), spectrum.begin() + num_bins, complex<float>(0.0f, 0.0f));
+            engine.inverse(spectrum.data(), frame.data());
+            for (int i = 0; i < win_length; ++i) {
+                band[(static_cast<size_t>(t) * hop_length + i) * CHANNELS + c] += frame[i];
+            }
+        }
+    }
+    return band;
+}
+
+// Exact path against complementary_stem: time of separate() and the error of
+// the last stem, in total and once the high band the exact path drops is
+// taken out.
+static int bench_complement(char* in, size_t byte_size, const string& bundle_path, int rounds) {
+    double duration = audio_seconds(byte_size);
+    vector<vector<float>> last_stem(2);
+    double baseline = 0.0;
+
+    cout << yellow << "Complementary last stem on " << duration << " s of audio, best of " << rounds << reset << endl;
+    for (int complement = 0; complement < 2; ++complement) {
+        EstimatorOptions options;
+        options.forward_types.push_back(MNN_FORWARD_CPU);
+        options.complementary_stem = complement != 0;
+
+        unique_ptr<Estimator> es = make_estimator(bundle_path, options);
+        if (!es) {
+            return -1;
+        }
+        size_t num_bytes = es->addFrames(in, byte_size);
+        vector<vector<char>> buffers;
+        vector<char*> outputs = alloc_outputs(buffers, es->stems().size(), num_bytes);
+        size_t out_bytes = es->separate(outputs);  // warm-up
+        double best = 0.0;
+        for (int round = 0; round < rounds; ++round) {
+            auto start_time = chrono::high_resolution_clock::now();
+            es->separate(outputs);
+            double seconds = chrono::duration<double>(chrono::high_resolution_clock::now() - start_time).count();
+            best = round == 0 ? seconds : min(best, seconds);
+        }
+        const float* last = reinterpret_cast<const float*>(buffers.back().data());
+        last_stem[complement].assign(last, last + out_bytes / sizeof(float));
+
+        if (baseline == 0.0) {
+            baseline = best;
+        }
+        cout << es->stems().size() << " stems, " << (complement ? "complementary: " : "exact:         ") << fixed << setprecision(3)
+             << best << " s, " << baseline / best << "x" << endl;
+        es.reset();
+    }
+
+    ModelBundle bundle(bundle_path);
+    vector<float> band = high_band(in, byte_size, bundle.win_length, bundle.hop_length, bundle.F);
+    double max_error = 0.0, max_residual = 0.0, signal = 0.0, error = 0.0;
+    for (size_t i = 0; i < last_stem[0].size(); ++i) {
+        double difference = static_cast<double>(last_stem[1][i]) - last_stem[0][i];
+        max_error = max(max_error, fabs(difference));
+        max_residual = max(max_residual, fabs(difference - band[i]));
+        signal += static_cast<double>(last_stem[0][i]) * last_stem[0][i];
+        error += difference * difference;
+    }
+    cout << scientific << setprecision(2) << "last stem: max error " << max_error << ", SNR " << fixed << setprecision(1) << 10.0 * log10(signal / error)
+         << " dB, max error without the band above F " << scientific << setprecision(2) << max_residual << endl;
+    return 0;
+}
+
+// SDR of an estimate against a reference, in dB.
+static double sdr(const vector<float>& reference, const vector<float>& estimate) {
+    double signal = 0.0, error = 0.0;
+    for (size_t i = 0; i < reference.size(); ++i) {
+        double difference = static_cast<double>(estimate[i]) - reference[i];
+        signal += static_cast<double>(reference[i]) * reference[i];
+        error += difference * difference;
+    }
+    return 10.0 * log10((signal + 1e-12) / (error + 1e-12));
+}
+
+// Evaluation harness for derived_mask_stem: every stem of the full path
+// against the output with each stem's model skipped in turn.
+static int bench_approximate(char* in, size_t byte_size, const string& bundle_path) {
+    double duration = audio_seconds(byte_size);
+    vector<vector<float>> reference;
+    vector<string> stems;
+    double baseline = 0.0;
+
+    cout << yellow << "Derived mask approximation on " << duration << " s of audio, SDR against the full path" << reset << endl;
+    for (size_t derived = 0; derived == 0 || derived <= stems.size(); ++derived) {
+        EstimatorOptions options;
+        options.forward_types.push_back(MNN_FORWARD_CPU);
+        if (derived > 0) {
+            options.derived_mask_stem = stems[derived - 1];
+        }
+
+        unique_ptr<Estimator> es = make_estimator(bundle_path, options);
+        if (!es) {
+            return -1;
+        }
+        stems = es->stems();
+        size_t num_bytes = es->addFrames(in, byte_size);
+        vector<vector<char>> buffers;
+        vector<char*> outputs = alloc_outputs(buffers, stems.size(), num_bytes);
+        size_t out_bytes = es->separate(outputs);  // warm-up
+        auto start_time = chrono::high_resolution_clock::now();
+        es->separate(outputs);
+        double seconds = chrono::duration<double>(chrono::high_resolution_clock::now() - start_time).count();
+        es.reset();
+
+        if (baseline == 0.0) {
+            baseline = seconds;
+        }
+        cout << (derived > 0 ? "derived " + stems[derived - 1] : string("full path")) << ": " << fixed << setprecision(3) << seconds << " s, "
+             << baseline / seconds << "x";
+        for (size_t i = 0; i < stems.size(); ++i) {
+            const float* wav = reinterpret_cast<const float*>(buffers[i].data());
+            vector<float> stem(wav, wav + out_bytes / sizeof(float));
+            if (derived == 0) {
+                reference.push_back(stem);
+            } else {
+                cout << ", " << stems[i] << " SDR " << setprecision(1) << sdr(reference[i], stem) << " dB";
+            }
+        }
+        cout << endl;
+    }
+    return 0;
+}
+
+// Chunked separate() with the three stages run one after the other and as
+// a pipeline; the outputs must match bit for bit.
+static int bench_pipeline(char* in, size_t byte_size, const string& vocal_model_path, const string& accompaniment_model_path, int depth) {
+    vector<vector<char>> buffers[2];
+    vector<char*> outputs[2];
+    double seconds[2];
+    size_t sizes[2];
+
+    for (int pipelined = 0; pipelined < 2; ++pipelined) {
+        EstimatorOptions options;
+        options.forward_types.push_back(MNN_FORWARD_CPU);
+        options.pipeline_depth = pipelined ? depth : 0;
+        unique_ptr<Estimator> es = make_estimator(vocal_model_path, accompaniment_model_path, options);
+        if (!es) {
+            return -1;
+        }
+
+        outputs[pipelined] = alloc_outputs(buffers[pipelined], 2, byte_size);
+        es->warm_up({1});
+        auto start_time = chrono::high_resolution_clock::now();
+        sizes[pipelined] = es->separate(in, byte_size, outputs[pipelined]);
+        seconds[pipelined] = chrono::duration<double>(chrono::high_resolution_clock::now() - start_time).count();
+        es.reset();
+    }
+
+    cout << yellow << "Pipeline depth " << depth << " on " << audio_seconds(byte_size) << " s of audio" << reset << endl;
+    cout << fixed << setprecision(3) << "sequential: " << seconds[0] << " s" << endl;
+    cout << "pipelined:  " << seconds[1] << " s, " << seconds[0] / seconds[1] << "x" << endl;
+    return report_diff(outputs[0], sizes[0], outputs[1], sizes[1]) ? 0 : -1;
+}
+
+// Clients separating short clips of mixed lengths (a quarter to 1.75 times
+// clip_seconds) at the same time, through one Estimator taken in turn and
+// through a BatchScheduler. Mixed lengths make the collected batch size vary.
+// Every clip the scheduler separated must match the same clip separated on
+// its own, which checks the batch padding and the routing of the masks.
+static int bench_scheduler(char* in, size_t byte_size, const string& vocal_model_path, const string& accompaniment_model_path, int num_clients, double clip_seconds, int max_batch, int max_wait_ms) {
+    size_t frame_size = CHANNELS * (PCM_FORMAT == PCM_FLOAT32 ? sizeof(float) : sizeof(short));
+    size_t max_clip_size = min(byte_size / frame_size, static_cast<size_t>(1.75 * clip_seconds * SAMPLE_RATE)) * frame_size;
+    const int rounds = 4;
+    auto clip_size = [&](int k, int round) {
+        double scale = 0.25 + 0.5 * ((k * rounds + round) % 4);
+        return min(max_clip_size, static_cast<size_t>(scale * clip_seconds * SAMPLE_RATE) * frame_size);
+    };
+
+    auto clip_start = [&](int k, int round) {
+        size_t start = static_cast<size_t>(k * rounds + round) * SAMPLE_RATE % ((byte_size - clip_size(k, round)) / frame_size + 1);
+        return in + start * frame_size;
+    };
+
+    // The outputs of every clip in both passes, allocated ahead of the timing
+    size_t num_clips = static_cast<size_t>(num_clients) * rounds;
+    vector<vector<vector<char>>> buffers[2];
+    vector<vector<char*>> outputs[2];
+    vector<size_t> sizes[2];
+    for (int batched = 0; batched < 2; ++batched) {
+        buffers[batched].resize(num_clips);
+        sizes[batched].resize(num_clips, 0);
+        for (size_t clip = 0; clip < num_clips; ++clip) {
+            outputs[batched].push_back(alloc_outputs(buffers[batched][clip], 2, clip_size(static_cast<int>(clip) / rounds, static_cast<int>(clip) % rounds)));
+        }
+    }
+
+    cout << yellow << num_clients << " clients, " << rounds << " clips of " << audio_seconds(clip_size(0, 0)) << " to "
+         << audio_seconds(max_clip_size) << " s each" << reset << endl;
+    for (int batched = 0; batched < 2; ++batched) {
+        EstimatorOptions options;
+        options.forward_types.push_back(MNN_FORWARD_CPU);
+        unique_ptr<Estimator> es = make_estimator(vocal_model_path, accompaniment_model_path, options);
+        if (!es) {
+            return -1;
+        }
+        BatchScheduler* scheduler = batched ? new BatchScheduler(*es, max_batch, max_wait_ms) : nullptr;
+        mutex estimator_mutex;
+
+        auto start_time = chrono::high_resolution_clock::now();
+        vector<thread> clients;
+        for (int k = 0; k < num_clients; ++k) {
+            clients.emplace_back([&, k]() {
+                for (int round = 0; round < rounds; ++round) {
+                    size_t clip = static_cast<size_t>(k) * rounds + round;
+                    size_t size = clip_size(k, round);
+                    if (scheduler) {
+                        sizes[batched][clip] = scheduler->separate(clip_start(k, round), size, outputs[batched][clip]);
+                    } else {
+                        lock_guard<mutex> lock(estimator_mutex);
+                        sizes[batched][clip] = es->separate(clip_start(k, round), size, outputs[batched][clip]);
+                    }
+                }
+            });
+        }
+        for (auto& client : clients) {
+            client.join();
+        }
+        double seconds = chrono::duration<double>(chrono::high_resolution_clock::now() - start_time).count();
+
+        cout << fixed << setprecision(1) << (batched ? "batch scheduler: " : "one at a time:   ") << num_clients * rounds / seconds << " clips/s";
+        if (scheduler) {
+            cout << ", " << scheduler->batches() << " runs of " << static_cast<double>(scheduler->segments()) / scheduler->batches() << " segments on average";
+        }
+        cout << endl;
+        delete scheduler;
+        es.reset();
+    }
+
+    // The clip that differs most, a size mismatch first, stands for all
+    size_t worst = 0;
+    float worst_diff = -1.0f;
+    for (size_t clip = 0; clip < num_clips; ++clip) {
+        float diff = numeric_limits<float>::infinity();
+        if (sizes[0][clip] == sizes[1][clip]) {
+            diff = 0.0f;
+            for (int i = 0; i < 2; ++i) {
+                diff = max(diff, max_abs_diff(outputs[0][clip][i], outputs[1][clip][i], sizes[0][clip]));
+            }
+        }
+        if (diff > worst_diff) {
+            worst = clip;
+            worst_diff = diff;
+        }
+    }
+    cout << num_clips << " clips against separate() one at a time, worst: ";
+    return report_diff(outputs[0][worst], sizes[0][worst], outputs[1][worst], sizes[1][worst]) ? 0 : -1;
+}
+
+// The whole track and a short clip with the last segment padded to T and
+// right-sized; the right-sized chunked and pipelined outputs must match the
+// right-sized whole-file one.
+static int bench_tail(char* in, size_t byte_size, const string& vocal_model_path, const string& accompaniment_model_path, double clip_seconds, int rounds) {
+    size_t frame_size = CHANNELS * (PCM_FORMAT == PCM_FLOAT32 ? sizeof(float) : sizeof(short));
+    size_t clip_size = min(byte_size / frame_size, static_cast<size_t>(clip_seconds * SAMPLE_RATE)) * frame_size;
+    size_t clip_sizes[2] = {byte_size, clip_size};
+    int result = 0;
+
+    for (size_t size : clip_sizes) {
+        cout << yellow << audio_seconds(size) << " s of audio" << reset << endl;
+        vector<vector<char>> reference_buffers;
+        vector<char*> reference;
+        size_t reference_size = 0;
+        for (int variant = 0; variant < 4; ++variant) {
+            EstimatorOptions options;
+            options.forward_types.push_back(MNN_FORWARD_CPU);
+            options.right_size_tail = variant > 0;
+            options.pipeline_depth = variant > 2 ? 2 : 0;
+            unique_ptr<Estimator> es = make_estimator(vocal_model_path, accompaniment_model_path, options);
+            if (!es) {
+                return -1;
+            }
+
+            vector<vector<char>> buffers;
+            vector<char*> outputs = alloc_outputs(buffers, 2, size);
+            auto separate = [&]() {
+                if (variant > 1) {
+                    return es->separate(in, size, outputs);
+                }
+                es->addFrames(in, size);
+                return es->separate(outputs);
+            };
+            size_t num_bytes = separate();
+            auto start_time = chrono::high_resolution_clock::now();
+            for (int round = 0; round < rounds; ++round) {
+                separate();
+            }
+            double seconds = chrono::duration<double>(chrono::high_resolution_clock::now() - start_time).count() / rounds;
+            es.reset();
+
+            const char* names[] = {"padded tail:           ", "right-sized:           ", "right-sized, chunked:  ", "right-sized, pipelined:"};
+            cout << names[variant] << fixed << setprecision(3) << " " << seconds << " s" << endl;
+            if (variant == 1) {
+                reference_buffers.swap(buffers);
+                reference = outputs;
+                reference_size = num_bytes;
+            } else if (variant > 1) {
+                if (!report_diff(reference, reference_size, outputs, num_bytes)) {
+                    result = -1;
+                }
+            }
+        }
+    }
+    return result;
+}
+
+// The track followed by as long a stretch of near silence (noise at -90
+// dBFS), separated with and without the silence gate.
+static int bench_silence(char* in, size_t byte_size, const string& vocal_model_path, const string& accompaniment_model_path, float threshold_db, int rounds) {
+    size_t num_values = byte_size / sizeof(float);
+    vector<float> podcast(reinterpret_cast<float*>(in), reinterpret_cast<float*>(in) + num_values);
+    uint32_t seed = 1;
+    for (size_t i = 0; i < num_values; ++i) {
+        seed = seed * 1664525u + 1013904223u;
+        podcast.push_back((static_cast<float>(seed >> 8) / (1 << 24) - 0.5f) * 2.0f * sqrt(3.0f) * 3.16e-5f);
+    }
+    size_t size = podcast.size() * sizeof(float);
+    char* data = reinterpret_cast<char*>(podcast.data());
+
+    cout << yellow << audio_seconds(size) << " s of audio, half of it silent, gate at " << threshold_db << " dBFS" << reset << endl;
+    vector<vector<char>> reference_buffers;
+    vector<char*> reference;
+    size_t reference_size = 0;
+    bool match = true;
+    for (int gated = 0; gated < 2; ++gated) {
+        EstimatorOptions options;
+        options.forward_types.push_back(MNN_FORWARD_CPU);
+        options.silence_threshold_db = gated ? threshold_db : 0.0f;
+        unique_ptr<Estimator> es = make_estimator(vocal_model_path, accompaniment_model_path, options);
+        if (!es) {
+            return -1;
+        }
+
+        vector<vector<char>> buffers;
+        vector<char*> outputs = alloc_outputs(buffers, 2, size);
+        size_t num_bytes = 0;
+        auto start_time = chrono::high_resolution_clock::now();
+        for (int round = 0; round < rounds; ++round) {
+            es->addFrames(data, size);
+            num_bytes = es->separate(outputs);
+        }
+        double seconds = chrono::duration<double>(chrono::high_resolution_clock::now() - start_time).count() / rounds;
+
+        cout << fixed << setprecision(3) << (gated ? "gated:     " : "ungated:   ") << seconds << " s";
+        if (gated) {
+            cout << ", " << es->skipped_segments() << " of " << es->gated_segments() << " segments skipped ("
+                 << setprecision(1) << 100.0 * es->skipped_segments() / max<size_t>(es->gated_segments(), 1) << "%)" << endl;
+            // Only the near-silent segments may change, by about their level
+            match = report_diff(reference, reference_size, outputs, num_bytes, 0, 1e-4f);
+        } else {
+            cout << endl;
+            reference_buffers.swap(buffers);
+            reference = outputs;
+            reference_size = num_bytes;
+        }
+        es.reset();
+    }
+    return match ? 0 : -1;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 4 || (argc < 5 && string(argv[1]) != "stems" && string(argv[1]) != "complement" && string(argv[1]) != "approximate")) {
+        cerr << "Usage: " << argv[0] << " threads <input_file_path> <vocal_model_path> <accompaniment_model_path> [max_threads]" << endl;
+        cerr << "       " << argv[0] << " chunked <input_file_path> <vocal_model_path> <accompaniment_model_path> [chunk_segments]" << endl;
+        cerr << "       " << argv[0] << " pipeline <input_file_path> <vocal_model_path> <accompaniment_model_path> [depth]" << endl;
+        cerr << "       " << argv[0] << " stream <input_file_path> <vocal_model_path> <accompaniment_model_path> [stream_frames] [block_ms]" << endl;
+        cerr << "       " << argv[0] << " scheduler <input_file_path> <vocal_model_path> <accompaniment_model_path> [clients] [clip_seconds] [max_batch] [max_wait_ms]" << endl;
+        cerr << "       " << argv[0] << " tail <input_file_path> <vocal_model_path> <accompaniment_model_path> [clip_seconds] [rounds]" << endl;
+        cerr << "       " << argv[0] << " silence <input_file_path> <vocal_model_path> <accompaniment_model_path> [threshold_db] [rounds]" << endl;
+        cerr << "       " << argv[0] << " batch <input_file_path> <vocal_model_path> <accompaniment_model_path> [max_batch]" << endl;
+        cerr << "       " << argv[0] << " cache <input_file_path> <vocal_model_path> <accompaniment_model_path> [rounds]" << endl;
+        cerr << "       " << argv[0] << " runtime <input_file_path> <vocal_model_path> <accompaniment_model_path>" << endl;
+        cerr << "       " << argv[0] << " tuning <input_file_path> <vocal_model_path> <accompaniment_model_path> [cache_prefix]" << endl;
+        cerr << "       " << argv[0] << " processes <input_file_path> <vocal_model_path> <accompaniment_model_path> [workers]" << endl;
+        cerr << "       " << argv[0] << " layout <input_file_path> <vocal_model_path> <accompaniment_model_path> [rounds]" << endl;
+        cerr << "       " << argv[0] << " stems <input_file_path> <bundle_path> [max_workers]" << endl;
+        cerr << "       " << argv[0] << " subset <input_file_path> <bundle_path> <stem> [rounds]" << endl;
+        cerr << "       " << argv[0] << " complement <input_file_path> <bundle_path> [rounds]" << endl;
+        cerr << "       " << argv[0] << " approximate <input_file_path> <bundle_path>" << endl;
+        return -1;
+    }
+
+    string mode = argv[1];
+    size_t byte_size = 0;
+    char* in = ReadPcmToByteArray(argv[2], byte_size);
+    if (in == nullptr) {
+        cerr << red << "Error reading input file" << reset << endl;
+        return -1;
+    }
+
+    int result = -1;
+    if (mode == "threads") {
+        int max_threads = argc > 5 ? atoi(argv[5]) : static_cast<int>(thread::hardware_concurrency());
+        result = bench_threads(in, byte_size, argv[3], argv[4], max_threads > 0 ? max_threads : 1);
+    } else if (mode == "chunked") {
+        int chunk_segments = argc > 5 ? atoi(argv[5]) : 1;
+        result = bench_chunked(in, byte_size, argv[3], argv[4], chunk_segments > 0 ? chunk_segments : 1);
+    } else if (mode == "pipeline") {
+        int depth = argc > 5 ? atoi(argv[5]) : 2;
+        result = bench_pipeline(in, byte_size, argv[3], argv[4], depth > 0 ? depth : 2);
+    } else if (mode == "stream") {
+        int stream_frames = argc > 5 ? atoi(argv[5]) : 512;
+        int block_ms = argc > 6 ? atoi(argv[6]) : 20;
+        result = bench_stream(in, byte_size, argv[3], argv[4], stream_frames, block_ms > 0 ? block_ms : 20);
+    } else if (mode == "scheduler") {
+        int num_clients = argc > 5 ? atoi(argv[5]) : 8;
+        double clip_seconds = argc > 6 ? atof(argv[6]) : 5.0;
+        int max_batch = argc > 7 ? atoi(argv[7]) : 8;
+        int max_wait_ms = argc > 8 ? atoi(argv[8]) : 10;
+        result = bench_scheduler(in, byte_size, argv[3], argv[4], num_clients > 0 ? num_clients : 8, clip_seconds > 0.0 ? clip_seconds : 5.0,
+                                 max_batch > 0 ? max_batch : 8, max_wait_ms >= 0 ? max_wait_ms : 10);
+    } else if (mode == "tail") {
+        double clip_seconds = argc > 5 ? atof(argv[5]) : 3.0;
+        int rounds = argc > 6 ? atoi(argv[6]) : 3;
+        result = bench_tail(in, byte_size, argv[3], argv[4], clip_seconds > 0.0 ? clip_seconds : 3.0, rounds > 0 ? rounds : 3);
+    } else if (mode == "silence") {
+        float threshold_db = argc > 5 ? static_cast<float>(atof(argv[5])) : -60.0f;
+        int rounds = argc > 6 ? atoi(argv[6]) : 3;
+        result = bench_silence(in, byte_size, argv[3], argv[4], threshold_db < 0.0f ? threshold_db : -60.0f, rounds > 0 ? rounds : 3);
+    } else if (mode == "batch") {
+        int max_batch = argc > 5 ? atoi(argv[5]) : 1;
+        result = bench_batch(in, byte_size, argv[3], argv[4], max_batch > 0 ? max_batch : 1);
+    } else if (mode == "cache") {
+        int rounds = argc > 5 ? atoi(argv[5]) : 5;
+        result = bench_cache(in, byte_size, argv[3], argv[4], rounds > 0 ? rounds : 5);
+    } else if (mode == "layout") {
+        int rounds = argc > 5 ? atoi(argv[5]) : 5;
+        result = bench_layout(in, byte_size, argv[3], argv[4], rounds > 0 ? rounds : 5);
+    } else if (mode == "runtime") {
+        result = bench_runtime(in, byte_size, argv[3], argv[4]);
+    } else if (mode == "tuning") {
+        result = bench_tuning(in, byte_size, argv[3], argv[4], argc > 5 ? argv[5] : "bench-tuning");
+    } else if (mode == "stems") {
+        int max_workers = argc > 4 ? atoi(argv[4]) : static_cast<int>(thread::hardware_concurrency());
+        result = bench_stems(in, byte_size, argv[3], max_workers > 0 ? max_workers : 1);
+    } else if (mode == "approximate") {
+        result = bench_approximate(in, byte_size, argv[3]);
+    } else if (mode == "complement") {
+        int rounds = argc > 4 ? atoi(argv[4]) : 5;
+        result = bench_complement(in, byte_size, argv[3], rounds > 0 ? rounds : 5);
+    } else if (mode == "subset") {
+        int rounds = argc > 5 ? atoi(argv[5]) : 5;
+        result = bench_subset(in, byte_size, argv[3], argv[4], rounds > 0 ? rounds : 5);
+    } else if (mode == "processes") {
+        int num_workers = argc > 5 ? atoi(argv[5]) : 8;
+        result = bench_processes(argv[3], argv[4], num_workers > 0 ? num_workers : 8);
+    } else {
+        cerr << red << "Unknown benchmark: " << mode << reset << endl;
+    }
+
+    delete[] in;
+    return result;
+}
@@ -0,0 +1,94 @@
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <random>
+#include "Stft.hpp"
+
+// Define ANSI color codes
+const char* yellow = "\033[33m";
+const char* reset = "\033[0m";
+
+using namespace std;
+using namespace Eigen;
+
+const int SAMPLE_RATE = 44100;
+const int WIN_LENGTH = 4096;
+const int HOP_LENGTH = 1024;
+
+// Inverse transform as Estimator::compute_istft used to do it: a fresh
+// Eigen::FFT and fresh frame vectors for every frame.
+static void legacy_istft(const MatrixXcf& spec, const VectorXf& win, VectorXf& out) {
+    Eigen::FFT<float> fft;
+    out.setZero();
+    for (int t = 0; t < spec.cols(); ++t) {
+        VectorXcf slice = spec.col(t);
+        VectorXf ifft_vec(WIN_LENGTH);
+        fft.inv(ifft_vec, slice, WIN_LENGTH);
+        out.segment(t * HOP_LENGTH, WIN_LENGTH) += ifft_vec.cwiseProduct(win);
+    }
+}
+
+// Inverse transform as Estimator::compute_istft does it now: only the F
+// non-zero bins are read and frames are added straight into the output.
+static void engine_istft(StftEngine& engine, const MatrixXcf& spec, int num_bins, VectorXf& out) {
+    out.setZero();
+    for (int t = 0; t < spec.cols(); ++t) {
+        engine.inverse_add(spec.col(t).data(), num_bins, out.data() + t * HOP_LENGTH);
+    }
+}
+
+template <typename Func>
+static double time_ms(int repeat, Func func) {
+    auto start_time = chrono::high_resolution_clock::now();
+    for (int i = 0; i < repeat; ++i) {
+        func();
+    }
+    auto end_time = chrono::high_resolution_clock::now();
+    return chrono::duration<double, milli>(end_time - start_time).count() / repeat;
+}
+
+int main(int argc, char* argv[]) {
+    int seconds = argc > 1 ? atoi(argv[1]) : 60;
+    int repeat = argc > 2 ? atoi(argv[2]) : 3;
+
+    VectorXf signal(seconds * SAMPLE_RATE);
+    mt19937 rng(0);
+    normal_distribution<float> noise(0.0f, 0.1f);
+    for (int i = 0; i < signal.size(); ++i) {
+        signal(i) = noise(rng);
+    }
+
+    VectorXf win = periodicHanningWindow(WIN_LENGTH);
+    const int F = 1024;
+    StftEngine engine(WIN_LENGTH, HOP_LENGTH, win);
+
+    MatrixXcf spec_legacy, spec_engine;
+    double stft_legacy_ms = time_ms(repeat, [&]() { spec_legacy = stft(signal, WIN_LENGTH, HOP_LENGTH, WIN_LENGTH, win); });
+    double stft_engine_ms = time_ms(repeat, [&]() { spec_engine = engine.stft(signal); });
+    float stft_diff = (spec_legacy - spec_engine).cwiseAbs().maxCoeff();
+
+    MatrixXcf spec_truncated;
+    double stft_truncated_ms = time_ms(repeat, [&]() { spec_truncated = engine.stft(signal, F); });
+    float truncated_diff = (spec_engine.topRows(F) - spec_truncated).cwiseAbs().maxCoeff();
+
+    // Estimator only keeps the lowest F bins and zero pads the rest before
+    // the inverse transform.
+    spec_legacy.bottomRows(spec_legacy.rows() - F).setZero();
+    spec_engine.bottomRows(spec_engine.rows() - F).setZero();
+    VectorXf wav_legacy(WIN_LENGTH + (spec_legacy.cols() - 1) * HOP_LENGTH);
+    VectorXf wav_engine(wav_legacy.size());
+    double istft_legacy_ms = time_ms(repeat, [&]() { legacy_istft(spec_legacy, win, wav_legacy); });
+    double istft_engine_ms = time_ms(repeat, [&]() { engine_istft(engine, spec_engine, F, wav_engine); });
+    float istft_diff = (wav_legacy - wav_engine).cwiseAbs().maxCoeff();
+
+    cout << fixed << setprecision(2);
+    cout << yellow << seconds << " s mono, " << spec_engine.cols() << " frames of " << WIN_LENGTH << reset << endl;
+    cout << "stft   legacy: " << stft_legacy_ms << " ms, engine: " << stft_engine_ms << " ms, speedup "
+         << stft_legacy_ms / stft_engine_ms << "x, max diff " << scientific << stft_diff << fixed << endl;
+    cout << "stft   first " << F << " bins: " << stft_truncated_ms << " ms, speedup over legacy "
+         << stft_legacy_ms / stft_truncated_ms << "x, max diff to full engine " << scientific << truncated_diff << fixed << endl;
+    cout << "istft  legacy: " << istft_legacy_ms << " ms, engine: " << istft_engine_ms << " ms, speedup "
+         << istft_legacy_ms / istft_engine_ms << "x, max diff " << scientific << istft_diff << fixed << endl;
+
+    return 0;
+}
@@ -3,6 +3,7 @@
 #include <iomanip>
 #include <chrono>
 #include "Estimator.hpp"
+#include "PcmFile.hpp"
 
 // Define ANSI color codes
 const char* red = "\033[31m";
@@ -17,50 +18,16 @@ const int SAMPLE_RATE = 44100;
 const int CHANNELS = 2;
 const enum AudioDataFormat PCM_FORMAT = PCM_FLOAT32;
 
-static bool WriteByteArrayToPcm(const char* filename, const char* data, size_t size) {
-    ofstream file(filename, ios::binary | ios::ate);
-    if (!file.is_open()) {
-        cerr << "Unable to open file: " << filename << endl;
-        return false;
-    }
-
-    file.write(data, size);
-    return true;
-}
-
-static char* ReadPcmToByteArray(const char* filename, size_t& size) {
-    ifstream file(filename, ios::binary | ios::ate);
-    if (!file.is_open()) {
-        cerr << "Unable to open file: " << filename << endl;
-        return nullptr;
-    }
-
-    size = file.tellg();
-    file.seekg(0, ios::beg);
-
-    char* data = new char[size];
-
-    if (!file.read(data, size)) {
-        cerr << "Error reading file: " << filename << endl;
-        delete[] data;
-        file.close();
-        return nullptr;
-    }
-
-    file.close();
-    return data;
-}
-
-
 int main(int argc, char* argv[]) {
-    if (argc != 4) {
+    if (argc != 3 && argc != 4) {
         cerr << "Usage: " << argv[0] << " <input_file_path> <vocal_model_path> <accompaniment_model_path>" << endl;
+        cerr << "       " << argv[0] << " <input_file_path> <model_bundle_path>" << endl;
         return -1;
     }
 
     string input_file_path = argv[1];
     string vocal_model_path = argv[2];
-    string accompaniment_model_path = argv[3];
+    string accompaniment_model_path = argc == 4 ? argv[3] : "";
 
     // Read input file
     size_t byte_size = 0;
@@ -74,7 +41,11 @@ int main(int argc, char* argv[]) {
     Estimator *es = nullptr;
     SignalInfo in_signal = {SAMPLE_RATE, CHANNELS, PCM_FORMAT};
     try {
-        es = new Estimator(vocal_model_path, accompaniment_model_path, in_signal);
+        if (argc == 4) {
+            es = new Estimator(vocal_model_path, accompaniment_model_path, in_signal);
+        } else {
+            es = new Estimator(vocal_model_path, in_signal);
+        }
     } catch (const runtime_error& e) {
         cerr << red << "Failed to initialize Estimator: " << e.what() << reset << endl;
         return -1;
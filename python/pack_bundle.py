@@ -0,0 +1,62 @@
+import argparse
+import struct
+import zlib
+
+# Layout read by cpp/src/ModelBundle.cpp, all fields little-endian:
+#   header (160 bytes): magic, version, stem count, F, T, win_length, hop_length,
+#                       input tensor name, output tensor name, CRC-32 of the data
+#   stem table (48 bytes per stem): name, offset, size
+#   model data, each model aligned to 64 bytes
+MAGIC = b"SMNB"
+VERSION = 1
+HEADER_FORMAT = "<4sIIiiii64s64sI"
+STEM_FORMAT = "<32sQQ"
+ALIGNMENT = 64
+
+
+def fixed_name(name: str, size: int) -> bytes:
+    data = name.encode("utf-8")
+    if not data or len(data) >= size:
+        raise ValueError(f"name '{name}' must be 1 to {size - 1} bytes")
+    return data
+
+
+def pack_bundle(output_path, stems, F, T, win_length, hop_length, input_name, output_name):
+    models = []
+    for name, path in stems:
+        with open(path, "rb") as f:
+            models.append((fixed_name(name, 32), f.read()))
+
+    table_end = struct.calcsize(HEADER_FORMAT) + len(models) * struct.calcsize(STEM_FORMAT)
+    data = bytearray()
+    table = b""
+    for name, model in models:
+        offset = table_end + len(data)
+        padding = -offset % ALIGNMENT
+        data += b"\0" * padding
+        table += struct.pack(STEM_FORMAT, name, offset + padding, len(model))
+        data += model
+
+    checksum = zlib.crc32(bytes(data)) & 0xFFFFFFFF
+    header = struct.pack(HEADER_FORMAT, MAGIC, VERSION, len(models), F, T, win_length, hop_length,
+                         fixed_name(input_name, 64), fixed_name(output_name, 64), checksum)
+    with open(output_path, "wb") as f:
+        f.write(header)
+        f.write(table)
+        f.write(data)
+
+
+if __name__ == '__main__':
+    parser = argparse.ArgumentParser(description="Pack stem models and the pipeline configuration into one bundle file.")
+    parser.add_argument("output", help="bundle file to write")
+    parser.add_argument("stems", nargs="+", help="stems as name=path/to/model.mnn, in output order")
+    parser.add_argument("--F", type=int, default=1024)
+    parser.add_argument("--T", type=int, default=512)
+    parser.add_argument("--win-length", type=int, default=4096)
+    parser.add_argument("--hop-length", type=int, default=1024)
+    parser.add_argument("--input-name", default="onnx::Pad_0")
+    parser.add_argument("--output-name", default="379")
+    args = parser.parse_args()
+
+    stems = [tuple(stem.split("=", 1)) for stem in args.stems]
+    pack_bundle(args.output, stems, args.F, args.T, args.win_length, args.hop_length, args.input_name, args.output_name)